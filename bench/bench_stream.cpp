@@ -0,0 +1,227 @@
+/*
+ * Stream throughput benchmark for the nabto C++ wrapper.
+ *
+ * The benchmark is linked against the loopback nabto client, every
+ * byte written to a stream is echoed back to the reader. One operation
+ * is a write of a chunk followed by reading the chunk back.
+ */
+#include <nabto_client.hpp>
+
+#include <3rdparty/cxxopts.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+class BenchResult {
+ public:
+    std::string name;
+    size_t chunkSize;
+    size_t ops;
+    double seconds;
+    uint64_t allocations;
+    std::chrono::nanoseconds p50;
+    std::chrono::nanoseconds p99;
+};
+
+typedef std::function<void (std::shared_ptr<nabto::client::Stream> stream, std::vector<uint8_t>& chunk)> StreamOperation;
+
+static std::chrono::nanoseconds percentile(std::vector<std::chrono::nanoseconds>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return std::chrono::nanoseconds(0);
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[index];
+}
+
+static BenchResult run(std::shared_ptr<nabto::client::Connection> connection, const std::string& name, size_t chunkSize, size_t ops, StreamOperation op)
+{
+    auto stream = connection->createStream();
+    stream->open(4242)->waitForResult();
+
+    std::vector<uint8_t> chunk(chunkSize, 0x42);
+    std::vector<std::chrono::nanoseconds> latencies;
+    latencies.reserve(ops);
+
+    // warm up such that pools and buffers are populated before measuring.
+    for (size_t i = 0; i < 8; i++) {
+        op(stream, chunk);
+    }
+
+    uint64_t allocationsBefore = allocations;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        auto start = std::chrono::steady_clock::now();
+        op(stream, chunk);
+        latencies.push_back(std::chrono::steady_clock::now() - start);
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocationsAfter = allocations;
+
+    stream->close()->waitForResult();
+
+    std::sort(latencies.begin(), latencies.end());
+    BenchResult r;
+    r.name = name;
+    r.chunkSize = chunkSize;
+    r.ops = ops;
+    r.seconds = std::chrono::duration<double>(end - begin).count();
+    r.allocations = allocationsAfter - allocationsBefore;
+    r.p50 = percentile(latencies, 0.50);
+    r.p99 = percentile(latencies, 0.99);
+    return r;
+}
+
+static void printHeader()
+{
+    std::cout << std::left << std::setw(24) << "operation"
+              << std::right << std::setw(10) << "chunk"
+              << std::setw(10) << "ops"
+              << std::setw(12) << "MB/s"
+              << std::setw(12) << "ops/s"
+              << std::setw(12) << "allocs/op"
+              << std::setw(12) << "p50 us"
+              << std::setw(12) << "p99 us" << std::endl;
+}
+
+static void printResult(const BenchResult& r)
+{
+    double bytes = (double)r.chunkSize * r.ops;
+    std::cout << std::left << std::setw(24) << r.name
+              << std::right << std::setw(10) << r.chunkSize
+              << std::setw(10) << r.ops
+              << std::fixed << std::setprecision(1)
+              << std::setw(12) << (bytes / r.seconds) / (1024.0 * 1024.0)
+              << std::setw(12) << r.ops / r.seconds
+              << std::setprecision(2)
+              << std::setw(12) << (double)r.allocations / r.ops
+              << std::setw(12) << r.p50.count() / 1000.0
+              << std::setw(12) << r.p99.count() / 1000.0 << std::endl;
+}
+
+static void benchOpen(std::shared_ptr<nabto::client::Connection> connection, size_t ops)
+{
+    std::vector<std::chrono::nanoseconds> latencies;
+    latencies.reserve(ops);
+    uint64_t allocationsBefore = allocations;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        auto start = std::chrono::steady_clock::now();
+        auto stream = connection->createStream();
+        stream->open(4242)->waitForResult();
+        latencies.push_back(std::chrono::steady_clock::now() - start);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::sort(latencies.begin(), latencies.end());
+
+    BenchResult r;
+    r.name = "createStream+open";
+    r.chunkSize = 0;
+    r.ops = ops;
+    r.seconds = std::chrono::duration<double>(end - begin).count();
+    r.allocations = allocations - allocationsBefore;
+    r.p50 = percentile(latencies, 0.50);
+    r.p99 = percentile(latencies, 0.99);
+    printResult(r);
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("bench_stream", "Benchmark the nabto::client::Stream wrapper against a loopback device.");
+    options.add_options()
+        ("h,help", "Show help")
+        ("total-bytes", "Bytes to transfer per chunk size", cxxopts::value<size_t>()->default_value("67108864"))
+        ("min-ops", "Minimum number of operations per chunk size", cxxopts::value<size_t>()->default_value("1000"))
+        ("max-chunk", "Largest chunk size", cxxopts::value<size_t>()->default_value("1048576"));
+
+    size_t totalBytes;
+    size_t minOps;
+    size_t maxChunk;
+    try {
+        auto result = options.parse(argc, argv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+        totalBytes = result["total-bytes"].as<size_t>();
+        minOps = result["min-ops"].as<size_t>();
+        maxChunk = result["max-chunk"].as<size_t>();
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Error parsing options: " << e.what() << std::endl;
+        return 1;
+    }
+
+    auto context = nabto::client::Context::create();
+    auto connection = context->createConnection();
+    connection->connect()->waitForResult();
+
+    std::cout << "nabto client " << nabto::client::Context::version() << std::endl;
+    printHeader();
+    benchOpen(connection, minOps);
+
+    auto pool = nabto::client::BufferPool::create(maxChunk);
+
+    std::vector<std::pair<std::string, StreamOperation> > operations = {
+        { "write+readAll", [](std::shared_ptr<nabto::client::Stream> stream, std::vector<uint8_t>& chunk) {
+                stream->write(chunk)->waitForResult();
+                stream->readAll(chunk.size())->waitForResult();
+            } },
+        { "write+readSome", [](std::shared_ptr<nabto::client::Stream> stream, std::vector<uint8_t>& chunk) {
+                stream->write(chunk)->waitForResult();
+                size_t read = 0;
+                while (read < chunk.size()) {
+                    read += stream->readSome(chunk.size() - read)->waitForResult().size();
+                }
+            } },
+        { "zerocopy write+readAll", [](std::shared_ptr<nabto::client::Stream> stream, std::vector<uint8_t>& chunk) {
+                stream->write(chunk.data(), chunk.size())->waitForResult();
+                stream->readAll(chunk.data(), chunk.size())->waitForResult();
+            } },
+        { "zerocopy write+readSome", [pool](std::shared_ptr<nabto::client::Stream> stream, std::vector<uint8_t>& chunk) {
+                auto buffer = pool->acquire();
+                stream->write(chunk.data(), chunk.size())->waitForResult();
+                size_t read = 0;
+                while (read < chunk.size()) {
+                    read += stream->readSome(buffer.data(), std::min(buffer.size(), chunk.size() - read))->waitForResult();
+                }
+            } }
+    };
+
+    for (auto& op : operations) {
+        for (size_t chunkSize = 64; chunkSize <= maxChunk; chunkSize *= 4) {
+            size_t ops = std::max(minOps, totalBytes / chunkSize);
+            printResult(run(connection, op.first, chunkSize, ops, op.second));
+        }
+    }
+    return 0;
+}
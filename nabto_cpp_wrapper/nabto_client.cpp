@@ -19,4 +19,160 @@ int ConnectionEventsCallback::CHANNEL_CHANGED() {
     return NABTO_CLIENT_CONNECTION_EVENT_CHANNEL_CHANGED;
 }
 
+bool Future::waitFor(std::chrono::milliseconds timeout)
+{
+    return waitFor((int)timeout.count());
+}
+
+std::shared_ptr<CancellationToken> CancellationToken::create()
+{
+    return std::make_shared<CancellationToken>();
+}
+
+CancellationToken::Registration CancellationToken::onCancel(std::function<void ()> stop)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cancelled_) {
+            uint64_t id = nextId_++;
+            stops_[id] = stop;
+            return Registration(shared_from_this(), id);
+        }
+    }
+    stop();
+    return Registration();
+}
+
+void CancellationToken::cancel()
+{
+    std::map<uint64_t, std::function<void ()> > stops;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) {
+            return;
+        }
+        cancelled_ = true;
+        stops.swap(stops_);
+    }
+    for (auto& stop : stops) {
+        stop.second();
+    }
+}
+
+void CancellationToken::remove(uint64_t id)
+{
+    std::function<void ()> stop;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = stops_.find(id);
+        if (it == stops_.end()) {
+            return;
+        }
+        stop = std::move(it->second);
+        stops_.erase(it);
+    }
+    // The captures of the stop function are released without the lock held.
+}
+
+CancellationToken::Registration::Registration(std::weak_ptr<CancellationToken> token, uint64_t id)
+    : token_(token), id_(id)
+{
+}
+
+CancellationToken::Registration::Registration(Registration&& other)
+    : token_(std::move(other.token_)), id_(other.id_)
+{
+    other.id_ = 0;
+}
+
+CancellationToken::Registration& CancellationToken::Registration::operator=(Registration&& other)
+{
+    if (this != &other) {
+        reset();
+        token_ = std::move(other.token_);
+        id_ = other.id_;
+        other.id_ = 0;
+    }
+    return *this;
+}
+
+CancellationToken::Registration::~Registration()
+{
+    reset();
+}
+
+void CancellationToken::Registration::reset()
+{
+    auto token = token_.lock();
+    if (token && id_ != 0) {
+        token->remove(id_);
+    }
+    token_.reset();
+    id_ = 0;
+}
+
+bool CancellationToken::isCancelled()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cancelled_;
+}
+
+std::shared_ptr<BufferPool> BufferPool::create(size_t bufferSize, size_t maxPooled)
+{
+    return std::make_shared<BufferPool>(bufferSize, maxPooled);
+}
+
+BufferPool::BufferPool(size_t bufferSize, size_t maxPooled)
+    : bufferSize_(bufferSize), maxPooled_(maxPooled)
+{
+    free_.reserve(maxPooled);
+}
+
+BufferPool::Buffer BufferPool::acquire()
+{
+    std::vector<uint8_t> data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            data = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    if (data.size() != bufferSize_) {
+        data.resize(bufferSize_);
+    }
+    return Buffer(shared_from_this(), std::move(data));
+}
+
+void BufferPool::release(std::vector<uint8_t> data)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() < maxPooled_) {
+        free_.push_back(std::move(data));
+    }
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other)
+{
+    if (this != &other) {
+        release();
+        pool_ = std::move(other.pool_);
+        data_ = std::move(other.data_);
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer()
+{
+    release();
+}
+
+void BufferPool::Buffer::release()
+{
+    if (pool_) {
+        pool_->release(std::move(data_));
+        pool_.reset();
+    }
+}
+
 } }
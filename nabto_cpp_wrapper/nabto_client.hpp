@@ -6,6 +6,9 @@
 #include <vector>
 #include <exception>
 #include <cstdint>
+#include <mutex>
+#include <chrono>
+#include <map>
 
 namespace nabto {
 namespace client {
@@ -127,6 +130,18 @@ class Future {
 #ifndef SWIGJAVA
     void callback(std::function<void (Status status)> cb);
 #endif
+
+    /**
+     * Wait at most the given time for the future to be resolved.
+     *
+     * @return true if the future is resolved, the outcome is then
+     * available from getResult(). false if the wait timed out, the
+     * operation continues until it completes or is stopped.
+     */
+    virtual bool waitFor(int milliseconds) = 0;
+#ifndef SWIGJAVA
+    bool waitFor(std::chrono::milliseconds timeout);
+#endif
 };
 
 
@@ -140,10 +155,25 @@ class FutureVoid : public Future {
 class FutureBuffer : public Future {
  public:
     virtual ~FutureBuffer() {}
+    /**
+     * Wait for the data. Use the FutureSize variants of the stream
+     * functions to read without copying the data.
+     */
     virtual std::vector<uint8_t> waitForResult() = 0;
     virtual std::vector<uint8_t> getResult() = 0;
 };
 
+/**
+ * Future for operations which transfer data to or from a caller owned
+ * buffer. The result is the number of bytes transferred.
+ */
+class FutureSize : public Future {
+ public:
+    virtual ~FutureSize() {}
+    virtual size_t waitForResult() = 0;
+    virtual size_t getResult() = 0;
+};
+
 
 
 class MdnsResult {
@@ -185,6 +215,11 @@ class Coap {
     virtual int getResponseStatusCode() = 0;
     virtual int getResponseContentFormat() = 0;
     virtual std::vector<uint8_t> getResponsePayload() = 0;
+    /**
+     * Stop an outstanding execute, the future is resolved with
+     * STOPPED. The request cannot be used after it has been stopped.
+     */
+    virtual void stop() = 0;
 };
 
 class Stream {
@@ -194,8 +229,22 @@ class Stream {
     virtual std::shared_ptr<FutureBuffer> readAll(size_t n) = 0;
     virtual std::shared_ptr<FutureBuffer> readSome(size_t max) = 0;
     virtual std::shared_ptr<FutureVoid> write(const std::vector<uint8_t>& buffer) = 0;
+
+    /**
+     * Zero copy variants of readAll, readSome and write. The data is
+     * read into or written from the caller owned buffer without
+     * intermediate copies. The buffer must stay valid until the
+     * returned future is resolved.
+     */
+    virtual std::shared_ptr<FutureSize> readAll(uint8_t* buffer, size_t n) = 0;
+    virtual std::shared_ptr<FutureSize> readSome(uint8_t* buffer, size_t max) = 0;
+    virtual std::shared_ptr<FutureVoid> write(const uint8_t* buffer, size_t size) = 0;
     virtual std::shared_ptr<FutureVoid> close() = 0;
     virtual void abort() = 0;
+    /**
+     * Same as abort, outstanding futures are resolved with STOPPED.
+     */
+    virtual void stop() = 0;
 };
 
 class TcpTunnel {
@@ -204,6 +253,11 @@ class TcpTunnel {
     virtual uint16_t getLocalPort() = 0;
     virtual std::shared_ptr<FutureVoid> open(const std::string& service, uint16_t localPort) = 0;
     virtual std::shared_ptr<FutureVoid> close() = 0;
+    /**
+     * Stop an outstanding open or close. The tunnel cannot be used
+     * after it has been stopped.
+     */
+    virtual void stop() = 0;
 };
 
 class ConnectionEventsCallback {
@@ -259,6 +313,11 @@ class Connection {
     virtual std::shared_ptr<Coap> createCoap(const std::string& method, const std::string& path) = 0;
     virtual std::shared_ptr<TcpTunnel> createTcpTunnel() = 0;
     virtual std::shared_ptr<FutureVoid> passwordAuthenticate(const std::string& username, const std::string& password) = 0;
+    /**
+     * Stop an outstanding connect or close. The connection cannot be
+     * used after it has been stopped.
+     */
+    virtual void stop() = 0;
 };
 
 class Context {
@@ -278,6 +337,117 @@ class Context {
 };
 
 #ifndef SWIGJAVA
+/**
+ * A pool of equally sized buffers for use with the zero copy stream
+ * functions. Buffers are handed back to the pool when they go out of
+ * scope, such that a bulk transfer does not allocate per read or write.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+ public:
+    class Buffer {
+     public:
+        Buffer() {}
+        Buffer(std::shared_ptr<BufferPool> pool, std::vector<uint8_t> data)
+            : pool_(pool), data_(std::move(data))
+        {
+        }
+        Buffer(Buffer&& other) = default;
+        Buffer& operator=(Buffer&& other);
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer();
+
+        uint8_t* data() { return data_.data(); }
+        size_t size() const { return data_.size(); }
+     private:
+        void release();
+        std::shared_ptr<BufferPool> pool_;
+        std::vector<uint8_t> data_;
+    };
+
+    static std::shared_ptr<BufferPool> create(size_t bufferSize, size_t maxPooled = 8);
+
+    BufferPool(size_t bufferSize, size_t maxPooled);
+
+    /**
+     * Get a buffer of bufferSize bytes, a new buffer is only allocated
+     * if the pool is empty.
+     */
+    Buffer acquire();
+    size_t getBufferSize() const { return bufferSize_; }
+
+ private:
+    void release(std::vector<uint8_t> data);
+
+    std::mutex mutex_;
+    size_t bufferSize_;
+    size_t maxPooled_;
+    std::vector<std::vector<uint8_t> > free_;
+};
+
+/**
+ * A cancellation token stops the operations registered on it when it is
+ * cancelled, e.g. when a request has exceeded its latency budget. An
+ * operation is registered while its registration is kept, so a long
+ * lived token does not keep finished operations alive.
+ *
+ *   auto token = CancellationToken::create();
+ *   auto future = coap->execute();
+ *   {
+ *       auto registration = token->onCancel([coap](){ coap->stop(); });
+ *       future->waitForResult();
+ *   }
+ *
+ * Tokens are created with create(), the registrations refer back to them.
+ */
+class CancellationToken : public std::enable_shared_from_this<CancellationToken> {
+ public:
+    /**
+     * Removes its stop function from the token when it is destroyed or
+     * reset.
+     */
+    class Registration {
+     public:
+        Registration() {}
+        Registration(std::weak_ptr<CancellationToken> token, uint64_t id);
+        Registration(Registration&& other);
+        Registration& operator=(Registration&& other);
+        ~Registration();
+        void reset();
+
+     private:
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+
+        std::weak_ptr<CancellationToken> token_;
+        uint64_t id_ = 0;
+    };
+
+    static std::shared_ptr<CancellationToken> create();
+
+    /**
+     * Register a function which stops an operation, until the returned
+     * registration is destroyed. The function is called right away if
+     * the token is already cancelled.
+     */
+    Registration onCancel(std::function<void ()> stop);
+
+    /**
+     * Cancel the token and stop all registered operations, cancelling
+     * a token more than once has no effect.
+     */
+    void cancel();
+    bool isCancelled();
+
+ private:
+    void remove(uint64_t id);
+
+    std::mutex mutex_;
+    bool cancelled_ = false;
+    uint64_t nextId_ = 1;
+    std::map<uint64_t, std::function<void ()> > stops_;
+};
+
 class CallbackFunction : public FutureCallback {
  public:
 
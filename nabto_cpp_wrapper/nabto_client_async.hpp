@@ -0,0 +1,154 @@
+#pragma once
+
+#include "nabto_client.hpp"
+
+#if defined(NABTO_CLIENT_ENABLE_COROUTINES)
+#include <coroutine>
+#include <exception>
+#endif
+
+/**
+ * Asynchronous adapters for the wrapper futures.
+ *
+ * The continuations and coroutines are resumed from the nabto client
+ * callback thread. Code running there must not block, in particular it
+ * must not call waitForResult() on another future.
+ *
+ * C++14 continuation style:
+ *
+ *   then(coap->execute(), [coap](Status status) { ... });
+ *
+ * C++20 coroutines (build with NABTO_CLIENT_COROUTINES=ON):
+ *
+ *   AsyncTask getMe(std::shared_ptr<Connection> connection) {
+ *       auto coap = connection->createCoap("GET", "/iam/me");
+ *       co_await coap->execute();
+ *       ...
+ *   }
+ */
+
+namespace nabto {
+namespace client {
+
+inline void then(std::shared_ptr<FutureVoid> future, std::function<void (Status status)> cb)
+{
+    future->callback(cb);
+}
+
+inline void then(std::shared_ptr<FutureBuffer> future, std::function<void (Status status, std::vector<uint8_t> data)> cb)
+{
+    // The future is alive while its callback runs, holding it from the
+    // callback would keep it alive forever.
+    auto raw = future.get();
+    future->callback([raw, cb](Status status) {
+        if (!status.ok()) {
+            cb(status, std::vector<uint8_t>());
+            return;
+        }
+        cb(status, raw->getResult());
+    });
+}
+
+inline void then(std::shared_ptr<FutureSize> future, std::function<void (Status status, size_t transferred)> cb)
+{
+    // The future is alive while its callback runs, holding it from the
+    // callback would keep it alive forever.
+    auto raw = future.get();
+    future->callback([raw, cb](Status status) {
+        if (!status.ok()) {
+            cb(status, 0);
+            return;
+        }
+        cb(status, raw->getResult());
+    });
+}
+
+inline void then(std::shared_ptr<FutureMdnsResult> future, std::function<void (Status status, std::shared_ptr<MdnsResult> result)> cb)
+{
+    // The future is alive while its callback runs, holding it from the
+    // callback would keep it alive forever.
+    auto raw = future.get();
+    future->callback([raw, cb](Status status) {
+        if (!status.ok()) {
+            cb(status, nullptr);
+            return;
+        }
+        cb(status, raw->getResult());
+    });
+}
+
+#if defined(NABTO_CLIENT_ENABLE_COROUTINES)
+
+/**
+ * A fire and forget coroutine. The coroutine starts immediately and
+ * runs until its first co_await, it is resumed from the nabto client
+ * callback thread. Exceptions escaping the coroutine terminate the
+ * program, catch NabtoException inside the coroutine.
+ */
+class AsyncTask {
+ public:
+    class promise_type {
+     public:
+        AsyncTask get_return_object() { return AsyncTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename FutureType>
+class FutureAwaiter {
+ public:
+    FutureAwaiter(std::shared_ptr<FutureType> future)
+        : future_(future), status_(Status::FUTURE_NOT_RESOLVED)
+    {
+    }
+
+    bool await_ready() { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        // The awaiter lives in the coroutine frame until it is resumed.
+        future_->callback([this, handle](Status status) {
+            status_ = status;
+            handle.resume();
+        });
+    }
+
+    auto await_resume()
+    {
+        if (!status_.ok()) {
+            throw NabtoException(status_);
+        }
+        return future_->getResult();
+    }
+
+ private:
+    std::shared_ptr<FutureType> future_;
+    Status status_;
+};
+
+inline FutureAwaiter<FutureVoid> operator co_await(std::shared_ptr<FutureVoid> future)
+{
+    return FutureAwaiter<FutureVoid>(future);
+}
+
+inline FutureAwaiter<FutureBuffer> operator co_await(std::shared_ptr<FutureBuffer> future)
+{
+    return FutureAwaiter<FutureBuffer>(future);
+}
+
+inline FutureAwaiter<FutureSize> operator co_await(std::shared_ptr<FutureSize> future)
+{
+    return FutureAwaiter<FutureSize>(future);
+}
+
+inline FutureAwaiter<FutureMdnsResult> operator co_await(std::shared_ptr<FutureMdnsResult> future)
+{
+    return FutureAwaiter<FutureMdnsResult>(future);
+}
+
+#endif
+
+} } // namespace
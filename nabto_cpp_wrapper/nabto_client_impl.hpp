@@ -60,25 +60,21 @@ bool Status::ok() const {
     return errorCode_ == 0;
 }
 
+class FuturePool;
+
+template <typename T>
+class FutureRecycler;
+
 class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_this<FutureBufferImpl>
 {
  public:
-    FutureBufferImpl(NabtoClient* context, std::shared_ptr<std::vector<uint8_t> > data, std::shared_ptr<size_t> transferred)
-        : future_(nabto_client_future_new(context)), data_(data), transferred_(transferred)
-    {
-    }
-    FutureBufferImpl(NabtoClientFuture* future, std::shared_ptr<std::vector<uint8_t> > data, std::shared_ptr<size_t> transferred)
-        : future_(future), data_(data), transferred_(transferred)
+    FutureBufferImpl(NabtoClient* context)
+        : future_(nabto_client_future_new(context))
     {
     }
     ~FutureBufferImpl()
     {
-        if (!ended_) {
-            auto c = std::make_shared<FutureBufferImpl>(future_, data_, transferred_);
-            c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
-        } else {
-            nabto_client_future_free(future_);
-        }
+        nabto_client_future_free(future_);
     }
 
     std::vector<uint8_t> waitForResult()
@@ -87,11 +83,22 @@ class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_thi
         ended_ = true;
         return getResult();
     }
+    bool waitFor(int milliseconds)
+    {
+        NabtoClientError ec = nabto_client_future_timed_wait(future_, milliseconds > 0 ? milliseconds : 0);
+        if (ec == NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED) {
+            return false;
+        }
+        ended_ = true;
+        return true;
+    }
     static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
     {
         FutureBufferImpl* self = (FutureBufferImpl*)data;
         self->ended_ = true;
-        self->cb_->run(Status(ec));
+        // A callback which refers to the future would otherwise keep it alive.
+        auto cb = std::move(self->cb_);
+        cb->run(Status(ec));
         self->selfReference_ = nullptr;
     }
     void callback(std::shared_ptr<FutureCallback> cb)
@@ -107,22 +114,109 @@ class FutureBufferImpl : public FutureBuffer, public std::enable_shared_from_thi
         if (ec) {
             throw NabtoException(ec);
         }
-        data_->resize(*transferred_);
-        return *data_;
+        data_.resize(transferred_);
+        return data_;
     }
     NabtoClientFuture* getFuture() {
         return future_;
     }
+
+    std::vector<uint8_t> data_;
+    size_t transferred_ = 0;
+
   private:
+    friend class FuturePool;
+    friend class FutureRecycler<FutureBufferImpl>;
+    void reset() {
+        data_.clear();
+        transferred_ = 0;
+        cb_.reset();
+        ended_ = false;
+    }
     NabtoClientFuture* future_;
-    std::shared_ptr<std::vector<uint8_t> > data_;
-    std::shared_ptr<size_t> transferred_;
+    std::shared_ptr<FuturePool> pool_;
     std::shared_ptr<FutureBufferImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
 };
 
 
+class FutureSizeImpl : public FutureSize, public std::enable_shared_from_this<FutureSizeImpl>
+{
+ public:
+    FutureSizeImpl(NabtoClient* context)
+        : future_(nabto_client_future_new(context))
+    {
+    }
+    ~FutureSizeImpl()
+    {
+        nabto_client_future_free(future_);
+    }
+
+    size_t waitForResult()
+    {
+        nabto_client_future_wait(future_);
+        ended_ = true;
+        return getResult();
+    }
+    bool waitFor(int milliseconds)
+    {
+        NabtoClientError ec = nabto_client_future_timed_wait(future_, milliseconds > 0 ? milliseconds : 0);
+        if (ec == NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED) {
+            return false;
+        }
+        ended_ = true;
+        return true;
+    }
+    static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
+    {
+        FutureSizeImpl* self = (FutureSizeImpl*)data;
+        self->ended_ = true;
+        // A callback which refers to the future would otherwise keep it alive.
+        auto cb = std::move(self->cb_);
+        cb->run(Status(ec));
+        self->selfReference_ = nullptr;
+    }
+    void callback(std::shared_ptr<FutureCallback> cb)
+    {
+        cb_ = cb;
+        selfReference_ = shared_from_this();
+        nabto_client_future_set_callback(future_,
+                                         &doCallback,
+                                         this);
+    }
+    size_t getResult() {
+        auto ec = nabto_client_future_error_code(future_);
+        if (ec) {
+            throw NabtoException(ec);
+        }
+        return transferred_;
+    }
+    NabtoClientFuture* getFuture() {
+        return future_;
+    }
+
+    size_t transferred_ = 0;
+    // The owner keeps the caller owned buffer alive until the future is resolved.
+    std::shared_ptr<void> owner_;
+
+  private:
+    friend class FuturePool;
+    friend class FutureRecycler<FutureSizeImpl>;
+    void reset() {
+        transferred_ = 0;
+        owner_.reset();
+        cb_.reset();
+        ended_ = false;
+    }
+    NabtoClientFuture* future_;
+    std::shared_ptr<FuturePool> pool_;
+    std::shared_ptr<FutureSizeImpl> selfReference_;
+    std::shared_ptr<FutureCallback> cb_;
+    bool ended_ = false;
+};
+
+
 class MdnsResultImpl : public MdnsResult {
  public:
     MdnsResultImpl(NabtoClientMdnsResult* result)
@@ -180,18 +274,9 @@ class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_
         : future_(nabto_client_future_new(context))
     {
     }
-    FutureMdnsResultImpl(NabtoClientFuture* future)
-        : future_(future)
-    {
-    }
     ~FutureMdnsResultImpl()
     {
-        if (!ended_) {
-            auto c = std::make_shared<FutureMdnsResultImpl>(future_);
-            c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
-        } else {
-            nabto_client_future_free(future_);
-        }
+        nabto_client_future_free(future_);
     }
 
     std::shared_ptr<MdnsResult> waitForResult()
@@ -200,11 +285,22 @@ class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_
         ended_ = true;
         return getResult();
     }
+    bool waitFor(int milliseconds)
+    {
+        NabtoClientError ec = nabto_client_future_timed_wait(future_, milliseconds > 0 ? milliseconds : 0);
+        if (ec == NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED) {
+            return false;
+        }
+        ended_ = true;
+        return true;
+    }
     static void doCallback(NabtoClientFuture* future, NabtoClientError ec, void* data)
     {
         FutureMdnsResultImpl* self = (FutureMdnsResultImpl*)data;
         self->ended_ = true;
-        self->cb_->run(Status(ec));
+        // A callback which refers to the future would otherwise keep it alive.
+        auto cb = std::move(self->cb_);
+        cb->run(Status(ec));
         self->selfReference_ = nullptr;
     }
 
@@ -227,10 +323,18 @@ class FutureMdnsResultImpl : public FutureMdnsResult, public std::enable_shared_
         return future_;
     }
 
-    NabtoClientMdnsResult* result_;
+    NabtoClientMdnsResult* result_ = nullptr;
 
   private:
+    friend class FuturePool;
+    friend class FutureRecycler<FutureMdnsResultImpl>;
+    void reset() {
+        result_ = nullptr;
+        cb_.reset();
+        ended_ = false;
+    }
     NabtoClientFuture* future_;
+    std::shared_ptr<FuturePool> pool_;
     std::shared_ptr<FutureMdnsResultImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
@@ -243,27 +347,9 @@ class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<Fu
     {
     }
 
-    FutureVoidImpl(NabtoClient* context,  std::shared_ptr<std::vector<uint8_t> > data)
-        : future_(nabto_client_future_new(context)), data_(data)
-    {
-    }
-
-    FutureVoidImpl(NabtoClientFuture* future, std::shared_ptr<std::vector<uint8_t> > data)
-        : future_(future), data_(data)
-    {
-    }
-    FutureVoidImpl(NabtoClientFuture* future)
-        : future_(future)
-    {
-    }
     ~FutureVoidImpl()
     {
-        if (!ended_) {
-            auto c = std::make_shared<FutureVoidImpl>(future_, data_);
-            c->callback(std::make_shared<CallbackFunction>([](Status){ /* do nothing */ }));
-        } else {
-            nabto_client_future_free(future_);
-        }
+        nabto_client_future_free(future_);
     }
     // waitForResult for result.
     void waitForResult() {
@@ -276,11 +362,21 @@ class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<Fu
     {
         FutureVoidImpl* self = (FutureVoidImpl*)data;
         self->ended_ = true;
-        self->cb_->run(Status(ec));
+        // A callback which refers to the future would otherwise keep it alive.
+        auto cb = std::move(self->cb_);
+        cb->run(Status(ec));
         self->selfReference_ = nullptr;
     }
 
-    //bool waitFor(int milliseconds) = 0;
+    bool waitFor(int milliseconds)
+    {
+        NabtoClientError ec = nabto_client_future_timed_wait(future_, milliseconds > 0 ? milliseconds : 0);
+        if (ec == NABTO_CLIENT_EC_FUTURE_NOT_RESOLVED) {
+            return false;
+        }
+        ended_ = true;
+        return true;
+    }
     void callback(std::shared_ptr<FutureCallback> cb)
     {
         cb_ = cb;
@@ -299,22 +395,276 @@ class FutureVoidImpl : public FutureVoid, public std::enable_shared_from_this<Fu
     NabtoClientFuture* getFuture() {
         return future_;
     }
+
+    // Copy of the data written by the operation, it has to live until the future is resolved.
+    std::vector<uint8_t> data_;
+
  private:
+    friend class FuturePool;
+    friend class FutureRecycler<FutureVoidImpl>;
+    void reset();
     NabtoClientFuture* future_;
-    std::shared_ptr<std::vector<uint8_t> > data_;
+    std::shared_ptr<FuturePool> pool_;
     std::shared_ptr<FutureVoidImpl> selfReference_;
     std::shared_ptr<FutureCallback> cb_;
     bool ended_ = false;
 };
 
 
-class MdnsResolverImpl : public MdnsResolver {
+/**
+ * Cache of fixed size memory blocks for the shared_ptr control blocks
+ * of pooled futures. The caches are never destroyed since control
+ * blocks can be released during static destruction.
+ */
+class BlockCache {
+ public:
+    static BlockCache& get(size_t size) {
+        static BlockCache** caches = createCaches();
+        return *caches[blockSize(size) / 16 - 1];
+    }
+
+    static bool cacheable(size_t size) {
+        return blockSize(size) <= maxBlockSize;
+    }
+
+    void* allocate() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                void* block = free_.back();
+                free_.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(size_);
+    }
+
+    void deallocate(void* block) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.size() < maxPooled) {
+                free_.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+ private:
+    static const size_t maxBlockSize = 128;
+    static const size_t maxPooled = 256;
+
+    BlockCache(size_t size)
+        : size_(size)
+    {
+        free_.reserve(maxPooled);
+    }
+    static size_t blockSize(size_t size) {
+        return ((size + 15) / 16) * 16;
+    }
+    static BlockCache** createCaches() {
+        BlockCache** caches = new BlockCache*[maxBlockSize / 16];
+        for (size_t i = 0; i < maxBlockSize / 16; i++) {
+            caches[i] = new BlockCache((i + 1) * 16);
+        }
+        return caches;
+    }
+
+    size_t size_;
+    std::mutex mutex_;
+    std::vector<void*> free_;
+};
+
+template <typename T>
+class BlockAllocator {
+ public:
+    typedef T value_type;
+    BlockAllocator() {}
+    template <typename U>
+    BlockAllocator(const BlockAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n != 1 || !BlockCache::cacheable(sizeof(T))) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(BlockCache::get(sizeof(T)).allocate());
+    }
+    void deallocate(T* p, size_t n) {
+        if (n != 1 || !BlockCache::cacheable(sizeof(T))) {
+            ::operator delete(p);
+            return;
+        }
+        BlockCache::get(sizeof(T)).deallocate(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const BlockAllocator<T>&, const BlockAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const BlockAllocator<T>&, const BlockAllocator<U>&) { return false; }
+
+template <typename T>
+class FreeFutures {
+ public:
+    FreeFutures() {
+        free_.reserve(maxPooled);
+    }
+    ~FreeFutures() {
+        clear();
+    }
+    T* take() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return nullptr;
+        }
+        T* future = free_.back();
+        free_.pop_back();
+        return future;
+    }
+    bool put(T* future) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_ || free_.size() >= maxPooled) {
+            return false;
+        }
+        free_.push_back(future);
+        return true;
+    }
+    void clear() {
+        std::vector<T*> futures;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            futures.swap(free_);
+        }
+        for (auto f : futures) {
+            delete f;
+        }
+    }
+ private:
+    static const size_t maxPooled = 256;
+    std::mutex mutex_;
+    std::vector<T*> free_;
+    bool closed_ = false;
+};
+
+/**
+ * Pool of wrapper futures and their native futures for a context.
+ *
+ * A native future can be reused once it has been resolved. When the last
+ * reference to a pooled future is released it is put back into the pool,
+ * if the operation is still in progress that happens from the completion
+ * callback of the native future such that buffers owned by the future
+ * stay valid until the operation has ended.
+ */
+class FuturePool : public std::enable_shared_from_this<FuturePool> {
  public:
-    MdnsResolverImpl(NabtoClient* context, const std::string& subtype)
+    FuturePool(NabtoClient* context)
         : context_(context)
     {
-        resolver_ = nabto_client_listener_new(context);
-        nabto_client_mdns_resolver_init_listener(context, resolver_, subtype.c_str());
+    }
+
+    NabtoClient* getContext() {
+        return context_;
+    }
+
+    std::shared_ptr<FutureVoidImpl> futureVoid() {
+        return checkout<FutureVoidImpl>(voids_);
+    }
+    std::shared_ptr<FutureBufferImpl> futureBuffer(size_t size) {
+        auto future = checkout<FutureBufferImpl>(buffers_);
+        future->data_.resize(size);
+        return future;
+    }
+    std::shared_ptr<FutureSizeImpl> futureSize(std::shared_ptr<void> owner) {
+        auto future = checkout<FutureSizeImpl>(sizes_);
+        future->owner_ = owner;
+        return future;
+    }
+    std::shared_ptr<FutureMdnsResultImpl> futureMdnsResult() {
+        return checkout<FutureMdnsResultImpl>(mdnsResults_);
+    }
+
+    bool put(FutureVoidImpl* future) { return voids_.put(future); }
+    bool put(FutureBufferImpl* future) { return buffers_.put(future); }
+    bool put(FutureSizeImpl* future) { return sizes_.put(future); }
+    bool put(FutureMdnsResultImpl* future) { return mdnsResults_.put(future); }
+
+    /**
+     * Free the pooled futures, this has to happen before the native
+     * context is freed. Futures released after this are freed directly.
+     */
+    void close() {
+        voids_.clear();
+        buffers_.clear();
+        sizes_.clear();
+        mdnsResults_.clear();
+    }
+
+ private:
+    template <typename T>
+    std::shared_ptr<T> checkout(FreeFutures<T>& freeFutures) {
+        T* future = freeFutures.take();
+        if (future == nullptr) {
+            future = new T(context_);
+        }
+        future->pool_ = shared_from_this();
+        return std::shared_ptr<T>(future, FutureRecycler<T>(), BlockAllocator<T>());
+    }
+
+    NabtoClient* context_;
+    FreeFutures<FutureVoidImpl> voids_;
+    FreeFutures<FutureBufferImpl> buffers_;
+    FreeFutures<FutureSizeImpl> sizes_;
+    FreeFutures<FutureMdnsResultImpl> mdnsResults_;
+};
+
+/**
+ * Deleter for pooled futures. A future which is released before it is
+ * resolved is recycled from the completion callback of the native future.
+ */
+template <typename T>
+class FutureRecycler {
+ public:
+    void operator()(T* future) const {
+        if (future->ended_) {
+            recycle(future);
+        } else {
+            nabto_client_future_set_callback(future->future_, &FutureRecycler<T>::resolved, future);
+        }
+    }
+    static void resolved(NabtoClientFuture* f, NabtoClientError ec, void* data) {
+        (void)f; (void)ec;
+        recycle((T*)data);
+    }
+    static void recycle(T* future) {
+        std::shared_ptr<FuturePool> pool = std::move(future->pool_);
+        future->reset();
+        if (!pool || !pool->put(future)) {
+            delete future;
+        }
+    }
+};
+
+inline void FutureVoidImpl::reset()
+{
+    // Keep the capacity of small write buffers for the next write.
+    if (data_.capacity() > 65536) {
+        std::vector<uint8_t>().swap(data_);
+    } else {
+        data_.clear();
+    }
+    cb_.reset();
+    ended_ = false;
+}
+
+
+class MdnsResolverImpl : public MdnsResolver {
+ public:
+    MdnsResolverImpl(std::shared_ptr<FuturePool> futures, const std::string& subtype)
+        : futures_(futures)
+    {
+        resolver_ = nabto_client_listener_new(futures->getContext());
+        nabto_client_mdns_resolver_init_listener(futures->getContext(), resolver_, subtype.c_str());
     }
     ~MdnsResolverImpl()
     {
@@ -322,7 +672,7 @@ class MdnsResolverImpl : public MdnsResolver {
     }
     virtual std::shared_ptr<FutureMdnsResult> getResult()
     {
-        auto future = std::make_shared<FutureMdnsResultImpl>(context_);
+        auto future = futures_->futureMdnsResult();
         nabto_client_listener_new_mdns_result(resolver_, future->getFuture(), &future->result_);
         return future;
     }
@@ -331,13 +681,13 @@ class MdnsResolverImpl : public MdnsResolver {
     }
  private:
     NabtoClientListener* resolver_;
-    NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
 };
 
 class CoapImpl : public Coap {
  public:
-    CoapImpl(NabtoClient* context, NabtoClientCoap* coap)
-        : context_(context)
+    CoapImpl(std::shared_ptr<FuturePool> futures, NabtoClientCoap* coap)
+        : futures_(futures)
     {
         request_ = coap;
     }
@@ -345,13 +695,13 @@ class CoapImpl : public Coap {
         nabto_client_coap_free(request_);
     };
 
-    static std::shared_ptr<CoapImpl> create(NabtoClient* context, NabtoClientConnection* connection, const std::string& method, const std::string& path)
+    static std::shared_ptr<CoapImpl> create(std::shared_ptr<FuturePool> futures, NabtoClientConnection* connection, const std::string& method, const std::string& path)
     {
         auto request_ = nabto_client_coap_new(connection, method.c_str(), path.c_str());
         if (!request_) {
             return nullptr;
         }
-        return std::make_shared<CoapImpl>(context, request_);
+        return std::make_shared<CoapImpl>(futures, request_);
     }
 
     void setRequestPayload(int contentFormat, const std::vector<uint8_t>& payload)
@@ -366,7 +716,7 @@ class CoapImpl : public Coap {
 
     std::shared_ptr<FutureVoid> execute()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_coap_execute(request_, future->getFuture());
         return future;
     }
@@ -405,16 +755,21 @@ class CoapImpl : public Coap {
         return ret;
     }
 
+    void stop()
+    {
+        nabto_client_coap_stop(request_);
+    }
+
  private:
     NabtoClientCoap* request_;
-    NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
 };
 
 
-class StreamImpl : public Stream {
+class StreamImpl : public Stream, public std::enable_shared_from_this<StreamImpl> {
  public:
-    StreamImpl(NabtoClientConnection* connection, NabtoClient* context)
-        : context_(context)
+    StreamImpl(NabtoClientConnection* connection, std::shared_ptr<FuturePool> futures)
+        : futures_(futures)
     {
         stream_ = nabto_client_stream_new(connection);
     }
@@ -423,36 +778,50 @@ class StreamImpl : public Stream {
     }
     std::shared_ptr<FutureVoid> open(uint32_t contentType)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_stream_open(stream_, future->getFuture(), contentType);
         return future;
     }
     std::shared_ptr<FutureBuffer> readAll(size_t n)
     {
-        auto data = std::make_shared<std::vector<uint8_t> >(n);
-        auto transferred = std::make_shared<size_t>();
-        auto future = std::make_shared<FutureBufferImpl>(context_,data, transferred);
-        nabto_client_stream_read_all(stream_, future->getFuture(), data->data(), data->size(), transferred.get());
+        auto future = futures_->futureBuffer(n);
+        nabto_client_stream_read_all(stream_, future->getFuture(), future->data_.data(), future->data_.size(), &future->transferred_);
         return future;
     }
     std::shared_ptr<FutureBuffer> readSome(size_t max)
     {
-        auto data = std::make_shared<std::vector<uint8_t> >(max);
-        auto transferred = std::make_shared<size_t>();
-        auto future = std::make_shared<FutureBufferImpl>(context_, data, transferred);
-        nabto_client_stream_read_some(stream_, future->getFuture(), data->data(), data->size(), transferred.get());
+        auto future = futures_->futureBuffer(max);
+        nabto_client_stream_read_some(stream_, future->getFuture(), future->data_.data(), future->data_.size(), &future->transferred_);
         return future;
     }
     std::shared_ptr<FutureVoid> write(const std::vector<uint8_t>& buffer)
     {
-        auto data = std::make_shared<std::vector<uint8_t> >(buffer.begin(), buffer.end());
-        auto future = std::make_shared<FutureVoidImpl>(context_, data);
-        nabto_client_stream_write(stream_, future->getFuture(), data->data(), data->size());
+        auto future = futures_->futureVoid();
+        future->data_.assign(buffer.begin(), buffer.end());
+        nabto_client_stream_write(stream_, future->getFuture(), future->data_.data(), future->data_.size());
+        return future;
+    }
+    std::shared_ptr<FutureSize> readAll(uint8_t* buffer, size_t n)
+    {
+        auto future = futures_->futureSize(shared_from_this());
+        nabto_client_stream_read_all(stream_, future->getFuture(), buffer, n, &future->transferred_);
+        return future;
+    }
+    std::shared_ptr<FutureSize> readSome(uint8_t* buffer, size_t max)
+    {
+        auto future = futures_->futureSize(shared_from_this());
+        nabto_client_stream_read_some(stream_, future->getFuture(), buffer, max, &future->transferred_);
+        return future;
+    }
+    std::shared_ptr<FutureVoid> write(const uint8_t* buffer, size_t size)
+    {
+        auto future = futures_->futureVoid();
+        nabto_client_stream_write(stream_, future->getFuture(), buffer, size);
         return future;
     }
     std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_stream_close(stream_, future->getFuture());
         return future;
     }
@@ -460,15 +829,19 @@ class StreamImpl : public Stream {
     {
         nabto_client_stream_abort(stream_);
     }
+    void stop()
+    {
+        nabto_client_stream_stop(stream_);
+    }
  private:
     NabtoClientStream* stream_;
-    NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
 };
 
 class TcpTunnelImpl : public TcpTunnel {
  public:
-    TcpTunnelImpl(NabtoClient* context, NabtoClientConnection* connection)
-        : context_(context)
+    TcpTunnelImpl(std::shared_ptr<FuturePool> futures, NabtoClientConnection* connection)
+        : futures_(futures)
     {
         tcpTunnel_ = nabto_client_tcp_tunnel_new(connection);
     }
@@ -477,18 +850,23 @@ class TcpTunnelImpl : public TcpTunnel {
     };
     virtual std::shared_ptr<FutureVoid> open(const std::string& service, uint16_t localPort)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_tcp_tunnel_open(tcpTunnel_, future->getFuture(), service.c_str(), localPort);
         return future;
     }
 
     virtual std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_tcp_tunnel_close(tcpTunnel_, future->getFuture());
         return future;
     }
 
+    virtual void stop()
+    {
+        nabto_client_tcp_tunnel_stop(tcpTunnel_);
+    }
+
     virtual uint16_t getLocalPort()
     {
         uint16_t localPort;
@@ -500,7 +878,7 @@ class TcpTunnelImpl : public TcpTunnel {
     }
  private:
     NabtoClientTcpTunnel* tcpTunnel_;
-    NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
 };
 
 
@@ -549,10 +927,10 @@ class ConnectionEventsListenerImpl : public std::enable_shared_from_this<Connect
 
 class ConnectionImpl : public Connection, public std::enable_shared_from_this<ConnectionImpl> {
  public:
-    ConnectionImpl(NabtoClient* context)
-        : context_(context)
+    ConnectionImpl(std::shared_ptr<FuturePool> futures)
+        : context_(futures->getContext()), futures_(futures)
     {
-        connection_ = nabto_client_connection_new(context);
+        connection_ = nabto_client_connection_new(context_);
     }
     ~ConnectionImpl() {
         connectionEventsListener_->stop();
@@ -741,38 +1119,43 @@ class ConnectionImpl : public Connection, public std::enable_shared_from_this<Co
 
     std::shared_ptr<FutureVoid> connect()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_connection_connect(connection_, future->getFuture());
         return future;
     }
     std::shared_ptr<Stream> createStream()
     {
-        return std::make_shared<StreamImpl>(connection_, context_);
+        return std::make_shared<StreamImpl>(connection_, futures_);
     }
     std::shared_ptr<FutureVoid> close()
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_connection_close(connection_, future->getFuture());
         return future;
     }
 
     std::shared_ptr<Coap> createCoap(const std::string& method, const std::string& path)
     {
-        return CoapImpl::create(context_, connection_, method, path);
+        return CoapImpl::create(futures_, connection_, method, path);
     }
 
     std::shared_ptr<TcpTunnel> createTcpTunnel()
     {
-        return std::make_shared<TcpTunnelImpl>(context_, connection_);
+        return std::make_shared<TcpTunnelImpl>(futures_, connection_);
     }
 
     std::shared_ptr<FutureVoid> passwordAuthenticate(const std::string& username, const std::string& password)
     {
-        auto future = std::make_shared<FutureVoidImpl>(context_);
+        auto future = futures_->futureVoid();
         nabto_client_connection_password_authenticate(connection_, username.c_str(), password.c_str(), future->getFuture());
         return future;
     }
 
+    void stop()
+    {
+        nabto_client_connection_stop(connection_);
+    }
+
     void notifyEvent(int event) {
         std::lock_guard<std::mutex> lock(mutex_);
         for (auto cb : eventsCallbacks_) {
@@ -795,6 +1178,7 @@ class ConnectionImpl : public Connection, public std::enable_shared_from_this<Co
  private:
     NabtoClientConnection* connection_;
     NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
     std::mutex mutex_;
     std::set<std::shared_ptr<ConnectionEventsCallback> > eventsCallbacks_;
     std::shared_ptr<ConnectionEventsListenerImpl> connectionEventsListener_;
@@ -840,21 +1224,23 @@ class ContextImpl : public Context {
  public:
     ContextImpl() {
         context_ = nabto_client_new();
+        futures_ = std::make_shared<FuturePool>(context_);
     }
     ~ContextImpl() {
         nabto_client_stop(context_);
+        futures_->close();
         loggerProxy_.reset();
         nabto_client_free(context_);
     }
 
     std::shared_ptr<Connection> createConnection() {
-        auto ptr = std::make_shared<ConnectionImpl>(context_);
+        auto ptr = std::make_shared<ConnectionImpl>(futures_);
         ptr->init();
         return ptr;
     }
 
     std::shared_ptr<MdnsResolver> createMdnsResolver(const std::string& subtype) {
-        return std::make_shared<MdnsResolverImpl>(context_, subtype);
+        return std::make_shared<MdnsResolverImpl>(futures_, subtype);
     }
 
     void setLogger(std::shared_ptr<Logger> logger) {
@@ -888,6 +1274,7 @@ class ContextImpl : public Context {
 
  private:
     NabtoClient* context_;
+    std::shared_ptr<FuturePool> futures_;
     std::shared_ptr<LoggerProxy> loggerProxy_;
 
 };
@@ -4,8 +4,12 @@
 #include <nabto_client.hpp>
 #include <nabto/nabto_client_experimental.h>
 #include <map>
+#include <3rdparty/nlohmann/json.hpp>
 
 #include "pairing.hpp"
+#include "coap_batch.hpp"
+#include "connection_pool.hpp"
+#include "device_discovery.hpp"
 #include "config.hpp"
 #include "timestamp.hpp"
 #include "iam.hpp"
@@ -14,34 +18,139 @@
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , context(nabto::client::Context::create())
+    , discovery(DeviceDiscovery::create(context, "tcptunnel"))
+    , pool(ConnectionPool::create(context, std::chrono::minutes(5), discovery))
 {
     ui->setupUi(this);
+    // One operation at a time, they share the pooled connections.
+    worker.setMaxThreadCount(1);
+    connect(this, &MainWindow::pairingProgress, this, &MainWindow::show_pairing_status);
+    connect(this, &MainWindow::pairingFinished, this, &MainWindow::show_pairing_result);
+    connect(this, &MainWindow::servicesListed, this, &MainWindow::show_services);
     update_bookmarks();
+    // Show the bookmarks paired by other client processes.
+    Configuration::WatchBookmarks([this]() {
+        QMetaObject::invokeMethod(this, "update_bookmarks", Qt::QueuedConnection);
+    });
 
 }
 
 MainWindow::~MainWindow()
 {
+    Configuration::WatchBookmarks(nullptr);
+    // The jobs emit signals on this window and use the pool.
+    worker.waitForDone();
     delete ui;
 }
 
 void MainWindow::on_pushButton_clicked()
 {
-    auto context = nabto::client::Context::create();
     std::string sct = ui -> lineEdit -> text().toStdString();
-    std::string str = string_pair(context, sct);
-    ui->label->setText(QString::fromStdString(str));
-    update_bookmarks();
+    ui->pushButton->setEnabled(false);
+    worker.start([this, sct]() {
+        emit pairingProgress("Pairing...");
+        std::string str = string_pair(context, sct, pool);
+        emit pairingFinished(QString::fromStdString(str));
+    });
+}
 
+// The services of the device as "id (type host:port)", separated by newlines.
+static std::string describe_services(std::shared_ptr<nabto::client::Connection> connection)
+{
+    auto coap = connection->createCoap("GET", "/tcp-tunnels/services");
+    coap->execute()->waitForResult();
+    if (coap->getResponseStatusCode() != 205 ||
+        coap->getResponseContentFormat() != NABTO_CLIENT_COAP_CONTENT_FORMAT_APPLICATION_CBOR)
+    {
+        return "Could not get the list of services";
+    }
+    auto ids = nlohmann::json::from_cbor(coap->getResponsePayload());
+    if (!ids.is_array() || ids.empty()) {
+        return "No services";
+    }
+    CoapBatch batch(connection);
+    for (auto& id : ids) {
+        batch.add("GET", "/tcp-tunnels/services/" + id.get<std::string>());
+    }
+    std::string out;
+    for (auto& result : batch.execute()) {
+        if (result.status.ok() &&
+            result.coap->getResponseStatusCode() == 205 &&
+            result.coap->getResponseContentFormat() == NABTO_CLIENT_COAP_CONTENT_FORMAT_APPLICATION_CBOR)
+        {
+            auto service = nlohmann::json::from_cbor(result.coap->getResponsePayload());
+            out += service["Id"].get<std::string>() + " (" + service["Type"].get<std::string>() + " " +
+                service["Host"].get<std::string>() + ":" + std::to_string(service["Port"].get<uint16_t>()) + ")\n";
+        }
+    }
+    return out;
 }
 
+void MainWindow::on_listWidget_itemDoubleClicked(QListWidgetItem* item)
+{
+    int index = item->data(Qt::UserRole).toInt();
+    ui->label->setText("Connecting...");
+    worker.start([this, index]() {
+        auto device = Configuration::FindPairedDevice(index);
+        if (!device) {
+            emit servicesListed("The bookmark has been deleted");
+            return;
+        }
+        auto connection = pool->get(*device);
+        if (!connection) {
+            emit servicesListed("Could not connect to the device");
+            return;
+        }
+        try {
+            emit servicesListed(QString::fromStdString(describe_services(connection)));
+        } catch (std::exception& e) {
+            // The connection is evicted by the pool if it was closed.
+            emit servicesListed(QString::fromStdString(std::string("Failed to get services: ") + e.what()));
+        }
+    });
+}
+
+void MainWindow::show_pairing_status(const QString& status)
+{
+    ui->label->setText(status);
+}
+
+void MainWindow::show_pairing_result(const QString& result)
+{
+    ui->label->setText(result);
+    ui->pushButton->setEnabled(true);
+    update_bookmarks();
+}
+
+void MainWindow::show_services(const QString& services)
+{
+    ui->label->setText(services);
+}
 
 void MainWindow::update_bookmarks() {
-    std::map<int, Configuration::DeviceInfo> services;
-    services = Configuration::PrintBookmarks();
-    int index = 0;
-    ui -> listWidget-> clear();
-    for (const auto& bookmark : services) {
-        ui -> listWidget -> addItem(bookmark.second.getFriendlyName().c_str());
+    // Both the bookmarks and the rows are ordered by the bookmark index,
+    // only the rows of changed bookmarks are touched.
+    auto services = Configuration::GetBookMarks();
+    int row = 0;
+    for (const auto& bookmark : *services) {
+        while (row < ui->listWidget->count() && ui->listWidget->item(row)->data(Qt::UserRole).toInt() < bookmark.first) {
+            delete ui->listWidget->takeItem(row);
+        }
+        QString name = QString::fromStdString(bookmark.second.getFriendlyName());
+        QListWidgetItem* item = row < ui->listWidget->count() ? ui->listWidget->item(row) : nullptr;
+        if (item && item->data(Qt::UserRole).toInt() == bookmark.first) {
+            if (item->text() != name) {
+                item->setText(name);
+            }
+        } else {
+            item = new QListWidgetItem(name);
+            item->setData(Qt::UserRole, bookmark.first);
+            ui->listWidget->insertItem(row, item);
+        }
+        row++;
     }
-}
\ No newline at end of file
+    while (ui->listWidget->count() > row) {
+        delete ui->listWidget->takeItem(row);
+    }
+}
@@ -2,6 +2,20 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QThreadPool>
+
+#include <memory>
+
+class ConnectionPool;
+class DeviceDiscovery;
+class QListWidgetItem;
+
+namespace nabto {
+namespace client {
+
+class Context;
+
+} }
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -17,11 +31,29 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+signals:
+    // Emitted from the worker thread, delivered on the GUI thread.
+    void pairingProgress(const QString& status);
+    void pairingFinished(const QString& result);
+    void servicesListed(const QString& services);
+
 private slots:
     void on_pushButton_clicked();
+    void on_listWidget_itemDoubleClicked(QListWidgetItem* item);
     void update_bookmarks();
+    void show_pairing_status(const QString& status);
+    void show_pairing_result(const QString& result);
+    void show_services(const QString& services);
 
 private:
     Ui::MainWindow *ui;
+    // One client context for the lifetime of the window, the connections
+    // made for pairing and listing services are kept in the pool.
+    std::shared_ptr<nabto::client::Context> context;
+    // Devices on the local network are connected to without the relay.
+    std::shared_ptr<DeviceDiscovery> discovery;
+    std::shared_ptr<ConnectionPool> pool;
+    // Runs the device operations such that connecting does not block the GUI.
+    QThreadPool worker;
 };
 #endif // MAINWINDOW_H
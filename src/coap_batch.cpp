@@ -0,0 +1,107 @@
+#include "coap_batch.hpp"
+
+CoapBatch::CoapBatch(std::shared_ptr<nabto::client::Connection> connection, size_t window)
+    : connection_(connection), window_(window == 0 ? 1 : window)
+{
+}
+
+size_t CoapBatch::add(const std::string& method, const std::string& path)
+{
+    Request request;
+    request.method = method;
+    request.path = path;
+    requests_.push_back(request);
+    return requests_.size() - 1;
+}
+
+size_t CoapBatch::add(const std::string& method, const std::string& path, int contentFormat, const std::vector<uint8_t>& payload)
+{
+    Request request;
+    request.method = method;
+    request.path = path;
+    request.contentFormat = contentFormat;
+    request.payload = payload;
+    requests_.push_back(request);
+    return requests_.size() - 1;
+}
+
+std::vector<CoapBatchResult> CoapBatch::execute()
+{
+    // The state is shared with the future callbacks as they can outlive this call.
+    auto state = std::make_shared<State>(connection_, requests_, window_);
+    state->pump();
+    state->wait();
+    return state->results();
+}
+
+CoapBatch::State::State(std::shared_ptr<nabto::client::Connection> connection, std::vector<Request> requests, size_t window)
+    : connection_(connection), requests_(requests), results_(requests_.size()), window_(window)
+{
+}
+
+void CoapBatch::State::pump()
+{
+    for (;;) {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (next_ >= requests_.size() || inFlight_ >= window_) {
+                return;
+            }
+            index = next_++;
+            inFlight_++;
+        }
+        start(index);
+    }
+}
+
+void CoapBatch::State::start(size_t index)
+{
+    const Request& request = requests_[index];
+    std::shared_ptr<nabto::client::Coap> coap;
+    std::shared_ptr<nabto::client::FutureVoid> future;
+    try {
+        coap = connection_->createCoap(request.method, request.path);
+        if (!coap) {
+            complete(index, nullptr, nabto::client::Status(nabto::client::Status::INVALID_ARGUMENT));
+            return;
+        }
+        if (request.contentFormat >= 0) {
+            coap->setRequestPayload(request.contentFormat, request.payload);
+        }
+        future = coap->execute();
+    } catch (nabto::client::NabtoException& e) {
+        complete(index, coap, e.status());
+        return;
+    }
+
+    auto self = shared_from_this();
+    future->callback([self, index, coap](nabto::client::Status status) {
+        self->complete(index, coap, status);
+        self->pump();
+    });
+}
+
+void CoapBatch::State::complete(size_t index, std::shared_ptr<nabto::client::Coap> coap, nabto::client::Status status)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    results_[index].coap = coap;
+    results_[index].status = status;
+    inFlight_--;
+    completed_++;
+    if (completed_ == requests_.size()) {
+        cond_.notify_all();
+    }
+}
+
+void CoapBatch::State::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this](){ return completed_ == requests_.size(); });
+}
+
+std::vector<CoapBatchResult> CoapBatch::State::results()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return results_;
+}
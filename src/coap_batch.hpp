@@ -0,0 +1,78 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The outcome of a single request in a CoapBatch.
+ */
+class CoapBatchResult {
+ public:
+    // The executed request, the response is read from it. nullptr if the request could not be created.
+    std::shared_ptr<nabto::client::Coap> coap;
+    // OK if a response was received, otherwise the reason the request failed.
+    nabto::client::Status status = nabto::client::Status(nabto::client::Status::UNKNOWN);
+};
+
+/**
+ * Execute many CoAP requests on one connection with up to window
+ * requests in flight. When a request completes the next one is started
+ * from the future callback, such that N requests take about N / window
+ * round trips instead of N.
+ */
+class CoapBatch {
+ public:
+    CoapBatch(std::shared_ptr<nabto::client::Connection> connection, size_t window = 16);
+
+    /**
+     * Add a request to the batch, the returned index is the position of
+     * the result in the vector returned from execute.
+     */
+    size_t add(const std::string& method, const std::string& path);
+    size_t add(const std::string& method, const std::string& path, int contentFormat, const std::vector<uint8_t>& payload);
+
+    /**
+     * Run all the requests and wait until they have completed. The
+     * results are in the order the requests were added.
+     */
+    std::vector<CoapBatchResult> execute();
+
+ private:
+    class Request {
+     public:
+        std::string method;
+        std::string path;
+        int contentFormat = -1;
+        std::vector<uint8_t> payload;
+    };
+
+    class State : public std::enable_shared_from_this<State> {
+     public:
+        State(std::shared_ptr<nabto::client::Connection> connection, std::vector<Request> requests, size_t window);
+        void pump();
+        void wait();
+        std::vector<CoapBatchResult> results();
+     private:
+        void start(size_t index);
+        void complete(size_t index, std::shared_ptr<nabto::client::Coap> coap, nabto::client::Status status);
+
+        std::shared_ptr<nabto::client::Connection> connection_;
+        std::vector<Request> requests_;
+        std::vector<CoapBatchResult> results_;
+        size_t window_;
+        size_t next_ = 0;
+        size_t inFlight_ = 0;
+        size_t completed_ = 0;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+    };
+
+    std::shared_ptr<nabto::client::Connection> connection_;
+    size_t window_;
+    std::vector<Request> requests_;
+};
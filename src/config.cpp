@@ -1,4 +1,5 @@
 #include "config.hpp"
+#include "state_store.hpp"
 
 #include <nabto_client.hpp>
 
@@ -11,12 +12,22 @@
 #include <algorithm>
 #include <memory>
 #include <list>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
 
 #if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
 #include <direct.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <io.h>
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 using json = nlohmann::json;
@@ -27,79 +38,149 @@ namespace Configuration
 
 static struct
 {
+    // Guards the members below, the bookmarks are guarded by the State.
+    std::shared_timed_mutex Mutex;
     string ConfigFilePath;
     string StateFilePath;
     string KeyFilePath;
-    std::map<int, DeviceInfo> Bookmarks;
+    std::shared_ptr<StateStore> State;
 
     bool HasLoadedConfigFile;
     string ServerUrl;
 } Configuration;
 
-void to_json(json& j, const DeviceInfo& d)
+static string ConfigFilePath()
+{
+    std::shared_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+    return Configuration.ConfigFilePath;
+}
+
+static string KeyFilePath()
+{
+    std::shared_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+    return Configuration.KeyFilePath;
+}
+
+static std::shared_ptr<StateStore> CurrentState()
+{
+    std::shared_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+    return Configuration.State;
+}
+
+bool FileExists(const string& Filename)
 {
-    j = json({
-            {"DeviceFingerprint", d.deviceFingerprint_},
-            {"DeviceId", d.deviceId_},
-            {"ProductId", d.productId_},
-            {"Sct", d.sct_}
-        });
-    if (!d.directCandidate_.empty()) {
-        j["DirectCandidate"] = d.directCandidate_;
+    std::ifstream f(Filename.c_str());
+    return f.good();
+}
+
+static bool SyncFile(FILE* File)
+{
+    if (fflush(File) != 0) {
+        return false;
     }
+#if defined(_WIN32)
+    return _commit(_fileno(File)) == 0;
+#else
+    return fsync(fileno(File)) == 0;
+#endif
 }
 
-void from_json(const json& j, DeviceInfo& d)
+// Make a rename in the directory of Filename durable.
+static void SyncDirectory(const string& Filename)
 {
-    j.at("DeviceFingerprint").get_to(d.deviceFingerprint_);
-    j.at("DeviceId").get_to(d.deviceId_);
-    j.at("ProductId").get_to(d.productId_);
-    j.at("Sct").get_to(d.sct_);
-    try {
-        j.at("DirectCandidate").get_to(d.directCandidate_);
-    } catch (const std::exception& e) {
-        // no direct candidate, fine
+#if !defined(_WIN32)
+    string::size_type Slash = Filename.rfind('/');
+    string Directory = Slash == string::npos ? "." : Filename.substr(0, Slash + 1);
+    int fd = open(Directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
     }
+#else
+    (void)Filename;
+#endif
 }
 
-bool WriteStringToFile(const string& String, const string& Filename)
+static bool WriteAndSync(const string& String, const string& Filename, const char* Mode)
 {
-    bool Status = false;
-    string TemporaryFileName = Filename + ".tmp";
-    std::remove(TemporaryFileName.c_str());
-    try {
-        std::ofstream StateFile(TemporaryFileName);
-        StateFile << String;
+    FILE* File = fopen(Filename.c_str(), Mode);
+    if (File == NULL) {
+        return false;
     }
-    catch (...) {
-        std::cout << "Could not open file stream to " << TemporaryFileName << std::endl;
+    bool Status = fwrite(String.data(), 1, String.size(), File) == String.size() && SyncFile(File);
+    if (fclose(File) != 0) {
+        Status = false;
     }
+    return Status;
+}
 
-    try {
-        std::remove(Filename.c_str());
-        std::rename(TemporaryFileName.c_str(), Filename.c_str());
+bool WriteStringToFile(const string& String, const string& Filename)
+{
+    string TemporaryFileName = Filename + ".tmp";
+    if (!WriteAndSync(String, TemporaryFileName, "wb")) {
+        std::cout << "Could not write to the file " << TemporaryFileName << std::endl;
         std::remove(TemporaryFileName.c_str());
-        Status = true;
+        return false;
     }
-    catch (...) {
+
+    // Replace the file atomically such that either the old or the new
+    // content is found after a crash.
+#if defined(_WIN32)
+    bool Replaced = MoveFileExA(TemporaryFileName.c_str(), Filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool Replaced = std::rename(TemporaryFileName.c_str(), Filename.c_str()) == 0;
+#endif
+    if (!Replaced) {
         std::cout << "Could not replace file " << Filename << " with " << TemporaryFileName << std::endl;
+        std::remove(TemporaryFileName.c_str());
+        return false;
+    }
+    SyncDirectory(Filename);
+    return true;
+}
+
+bool AppendStringToFile(const string& String, const string& Filename)
+{
+    FILE* File = fopen(Filename.c_str(), "ab");
+    if (File == NULL) {
+        std::cout << "Could not open the file " << Filename << std::endl;
+        return false;
     }
+    bool Status = fwrite(String.data(), 1, String.size(), File) == String.size();
+    if (fclose(File) != 0 || !Status) {
+        std::cout << "Could not append to the file " << Filename << std::endl;
+        return false;
+    }
+    return true;
+}
 
+bool SyncFileToDisk(const string& Filename)
+{
+    FILE* File = fopen(Filename.c_str(), "ab");
+    if (File == NULL) {
+        return false;
+    }
+    bool Status = SyncFile(File);
+    if (fclose(File) != 0) {
+        Status = false;
+    }
+    // The file may have been created since the directory was synced.
+    SyncDirectory(Filename);
     return Status;
 }
 
 bool ReadEntireFileZeroTerminated(const string& Filename, string& Out)
 {
     bool Success = false;
-    std::ifstream InputStream(Filename);
+    std::ifstream InputStream(Filename, std::ios::binary);
     if (InputStream) {
 
         InputStream.seekg(0, std::ios::end);
         size_t size = InputStream.tellg();
         InputStream.seekg(0, std::ios::beg);
-        std::vector<char> Buffer(size);
+        Out.resize(size);
 
-        InputStream.read(Buffer.data(), Buffer.size());
+        InputStream.read(&Out[0], Out.size());
         if (!InputStream && !InputStream.eof()) {
             Success = false;
             std::cout << "Could not read input stream for file " << Filename << std::endl;
@@ -108,10 +189,6 @@ bool ReadEntireFileZeroTerminated(const string& Filename, string& Out)
         }
 
         InputStream.close();
-
-        if (Success) {
-            Out = string(Buffer.data(), Buffer.size());
-        }
     } else {
         std::cout << "Could not open input stream for file " << Filename << std::endl;
     }
@@ -119,44 +196,109 @@ bool ReadEntireFileZeroTerminated(const string& Filename, string& Out)
     return Success;
 }
 
-bool FileExists(const string& Filename)
+FileStamp StatFile(const string& Filename)
 {
-    std::ifstream f(Filename.c_str());
-    return f.good();
+    FileStamp Stamp;
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(Filename.c_str(), &st) == 0) {
+        Stamp.exists = true;
+        Stamp.size = st.st_size;
+        Stamp.modified = st.st_mtime;
+    }
+#else
+    struct stat st;
+    if (::stat(Filename.c_str(), &st) == 0) {
+        Stamp.exists = true;
+        Stamp.size = st.st_size;
+#if defined(__APPLE__)
+        Stamp.modified = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        Stamp.modified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    }
+#endif
+    return Stamp;
 }
 
-void CommonInit()
+// A file parsed into a T, the file is read again when its stamp changes.
+template <typename T>
+class CachedFile
 {
-    Configuration.HasLoadedConfigFile = false;
-    Configuration.ServerUrl = "";
-
-    json StateContents;
-    try
+ public:
+    std::shared_ptr<const T> find(const string& Path, const FileStamp& Stamp)
     {
-        std::ifstream StateFile(Configuration.StateFilePath);
-        StateFile >> StateContents;
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (Value && this->Path == Path && this->Stamp == Stamp) {
+            return Value;
+        }
+        return nullptr;
     }
-    catch (...)
+
+    // Stamp has to be taken before the file is read, such that a change
+    // made while reading it is detected by the next find.
+    void store(const string& Path, const FileStamp& Stamp, std::shared_ptr<const T> Value)
     {
-        // NOTE(as): State file wasn't found, it'll probably be created later.
+        std::lock_guard<std::mutex> lock(Mutex);
+        this->Path = Path;
+        this->Stamp = Stamp;
+        this->Value = std::move(Value);
     }
 
-    try
-    {
-        for(auto Device : StateContents["devices"])
-        {
-            DeviceInfo Info = Device.get<DeviceInfo>();
-            Configuration.Bookmarks[Configuration.Bookmarks.size()] = Info;
+ private:
+    std::mutex Mutex;
+    string Path;
+    FileStamp Stamp;
+    std::shared_ptr<const T> Value;
+};
+
+// Every connection needs the client configuration and the private key,
+// they are only read and parsed again when the files are changed.
+static CachedFile<ClientConfiguration> ConfigCache;
+static CachedFile<string> KeyCache;
+// Missing files are generated by one thread at a time, such that
+// concurrent first connects neither race on the temporary file nor
+// generate different private keys.
+static std::mutex GenerateMutex;
+
+// Called with Configuration.Mutex held, returns the previous state store.
+std::shared_ptr<StateStore> CommonInit()
+{
+    Configuration.HasLoadedConfigFile = false;
+    Configuration.ServerUrl = "";
+
+    // The bookmarks are loaded the first time they are used.
+    std::shared_ptr<StateStore> Previous = std::move(Configuration.State);
+    Configuration.State = std::make_shared<StateStore>(Configuration.StateFilePath);
+    return Previous;
+}
+
+// Load the bookmarks on first use, and pick up the changes made by other
+// client processes. Returns null if the configuration is not initialized.
+static std::shared_ptr<StateStore> LoadBookmarks()
+{
+    std::shared_ptr<StateStore> State = CurrentState();
+    if (!State) {
+        return nullptr;
+    }
+    if (State->isLoaded()) {
+        State->refresh();
+        return State;
+    }
+    if (StatFile(ConfigFilePath()).exists) {
+        auto Config = GetConfigInfo();
+        if (Config) {
+            State->setEncoding(Config->getStateEncoding());
         }
     }
-    catch (...)
+    if (!State->load())
     {
         // NOTE(as): Corrupted state file.
         // TODO(as): Analyze the file and let the user know where exactly it went wrong?
-        std::cerr << "IMPORTANT: Your state file (" << Configuration.StateFilePath << ") seems to be incorrect.\n" <<
+        std::cerr << "IMPORTANT: Your state file (" << GetStateFilePath() << ") seems to be incorrect.\n" <<
             "As a result no paired devices were loaded from it." << std::endl;
-        Configuration.Bookmarks.clear();
     }
+    return State;
 }
 
 string NormalizePath(const char *Path)
@@ -173,168 +315,246 @@ void InitializeWithDirectory(const string &HomePath)
 {
     std::string NormalizedHomePath = NormalizePath(HomePath.c_str());
 
-    Configuration.ConfigFilePath.assign(NormalizedHomePath);
-    Configuration.StateFilePath.assign(NormalizedHomePath);
-    Configuration.KeyFilePath.assign(NormalizedHomePath);
-
-    char LastCharacter = NormalizedHomePath.back();
-    if (LastCharacter != '/')
+    if (NormalizedHomePath.back() != '/')
     {
-        Configuration.ConfigFilePath.append("/");
-        Configuration.StateFilePath.append("/");
-        Configuration.KeyFilePath.append("/");
+        NormalizedHomePath.append("/");
     }
 
-    Configuration.ConfigFilePath.append(ClientFileName);
-    Configuration.StateFilePath.append(StateFileName);
-    Configuration.KeyFilePath.append(KeyFileName);
-
-    CommonInit();
+    std::shared_ptr<StateStore> Previous;
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+        Configuration.ConfigFilePath = NormalizedHomePath + ClientFileName;
+        Configuration.StateFilePath = NormalizedHomePath + StateFileName;
+        Configuration.KeyFilePath = NormalizedHomePath + KeyFileName;
+        Previous = CommonInit();
+    }
+    // Waits for the pending writes of the previous state store, if no one
+    // else is using it.
+    Previous.reset();
 }
 
 bool CreateClientConfigurationFile()
 {
     std::string clientConfig = "{}";
-    return WriteStringToFile(clientConfig, Configuration.ConfigFilePath);
+    return WriteStringToFile(clientConfig, ConfigFilePath());
 }
 
 std::unique_ptr<ClientConfiguration> GetConfigInfo()
 {
-    if (!FileExists(Configuration.ConfigFilePath)) {
-        if (!CreateClientConfigurationFile()) {
-            std::cerr << "The client configuration file " << Configuration.ConfigFilePath << " does not exist and could not be generated. " << std::endl;
+    string Path = ConfigFilePath();
+    FileStamp Stamp = StatFile(Path);
+    if (!Stamp.exists) {
+        std::lock_guard<std::mutex> lock(GenerateMutex);
+        if (!StatFile(Path).exists && !CreateClientConfigurationFile()) {
+            std::cerr << "The client configuration file " << Path << " does not exist and could not be generated. " << std::endl;
             return nullptr;
         }
+        Stamp = StatFile(Path);
     }
 
-    std::string config;
-    if (!ReadEntireFileZeroTerminated(Configuration.ConfigFilePath, config)) {
-        return nullptr;
-    }
+    std::shared_ptr<const ClientConfiguration> Cached = ConfigCache.find(Path, Stamp);
+    if (!Cached) {
+        std::string config;
+        if (!ReadEntireFileZeroTerminated(Path, config)) {
+            return nullptr;
+        }
 
-    json Contents = json::parse(config);
+        json Contents = DecodeDocument(config.data(), config.data() + config.size());
 
-    std::string serverUrl;
+        std::string serverUrl;
+        FileEncoding stateEncoding = FileEncoding::JSON;
 
-    try {
-        serverUrl = Contents["ServerUrl"].get<string>();
-    } catch (std::exception& e) {
-        // fine the server url is optional.
-    }
+        try {
+            serverUrl = Contents["ServerUrl"].get<string>();
+        } catch (std::exception& e) {
+            // fine the server url is optional.
+        }
+
+        if (Contents.contains("StateFormat") && Contents["StateFormat"] == "cbor") {
+            stateEncoding = FileEncoding::CBOR;
+        }
 
-    return std::make_unique<ClientConfiguration>(serverUrl);
+        Cached = std::make_shared<ClientConfiguration>(serverUrl, stateEncoding);
+        ConfigCache.store(Path, Stamp, Cached);
+    }
+    return std::make_unique<ClientConfiguration>(*Cached);
 }
 
-const char* GetConfigFilePath()
+std::string GetConfigFilePath()
 {
-    return Configuration.ConfigFilePath.c_str();
+    std::shared_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+    return Configuration.ConfigFilePath;
 }
 
-const char* GetStateFilePath()
+std::string GetStateFilePath()
 {
-    return Configuration.StateFilePath.c_str();
+    std::shared_lock<std::shared_timed_mutex> lock(Configuration.Mutex);
+    return Configuration.StateFilePath;
 }
 
 bool WriteStateFile()
 {
-    json BookmarksArray = json::array();
-    for (auto Bookmark : Configuration.Bookmarks) {
-        BookmarksArray.push_back(Bookmark.second);
+    auto State = LoadBookmarks();
+    if (!State) {
+        return false;
     }
-    json Contents = { {"devices", BookmarksArray} };
+    return State->flush();
+}
 
-    return WriteStringToFile(Contents.dump(2), Configuration.StateFilePath);
+bool SyncStateFile()
+{
+    auto State = CurrentState();
+    if (!State) {
+        return false;
+    }
+    return State->sync();
 }
 
-std::unique_ptr<DeviceInfo> GetPairedDevice(int index)
+void WatchBookmarks(std::function<void ()> OnChange)
 {
-    if (index >= 0 && Configuration.Bookmarks.size() > static_cast<unsigned int>(index))
-    {
-        auto device = std::make_unique<DeviceInfo>(Configuration.Bookmarks[index]);
-        device->index_ = index;
-        return device;
+    auto State = LoadBookmarks();
+    if (State) {
+        State->watch(OnChange);
     }
-    else
-    {
+}
+
+static std::shared_ptr<const BookmarkTable> CurrentBookmarks()
+{
+    auto State = LoadBookmarks();
+    if (!State) {
+        return std::make_shared<BookmarkTable>();
+    }
+    return State->bookmarks();
+}
+
+// Share ownership of the snapshot such that the device stays valid.
+static std::shared_ptr<const DeviceInfo> SnapshotDevice(std::shared_ptr<const BookmarkTable> Bookmarks, const DeviceInfo* Device)
+{
+    if (Device == nullptr) {
+        return nullptr;
+    }
+    return std::shared_ptr<const DeviceInfo>(Bookmarks, Device);
+}
+
+std::unique_ptr<DeviceInfo> GetPairedDevice(int index)
+{
+    auto device = FindPairedDevice(index);
+    if (!device) {
         return nullptr;
     }
+    return std::make_unique<DeviceInfo>(*device);
 }
 
 std::unique_ptr<DeviceInfo> GetPairedDevice(const std::string& deviceFingerprint)
 {
-    for (auto& bookmark : Configuration.Bookmarks) {
-        if (bookmark.second.getDeviceFingerprint() == deviceFingerprint ) {
-            auto device = std::make_unique<DeviceInfo>(bookmark.second);
-            device->index_ = bookmark.first;
-            return device;
-        }
+    auto device = FindPairedDevice(deviceFingerprint);
+    if (!device) {
+        return nullptr;
     }
-    return nullptr;
+    return std::make_unique<DeviceInfo>(*device);
+}
+
+std::shared_ptr<const DeviceInfo> FindPairedDevice(int index)
+{
+    auto Bookmarks = CurrentBookmarks();
+    return SnapshotDevice(Bookmarks, Bookmarks->find(index));
+}
+
+std::shared_ptr<const DeviceInfo> FindPairedDevice(const std::string& deviceFingerprint)
+{
+    auto Bookmarks = CurrentBookmarks();
+    return SnapshotDevice(Bookmarks, Bookmarks->findByFingerprint(deviceFingerprint));
+}
+
+std::shared_ptr<const DeviceInfo> FindPairedDevice(const std::string& productId, const std::string& deviceId)
+{
+    auto Bookmarks = CurrentBookmarks();
+    return SnapshotDevice(Bookmarks, Bookmarks->findByDeviceId(productId, deviceId));
 }
 
 bool HasNoBookmarks()
 {
-    return Configuration.Bookmarks.empty();
+    return CurrentBookmarks()->empty();
 }
 
-void AddPairedDeviceToBookmarks(DeviceInfo& Info)
+bool AddPairedDeviceToBookmarks(DeviceInfo& Info)
 {
-    for (auto b : Configuration.Bookmarks) {
-        if (b.second.getDeviceId() == Info.getDeviceId() && b.second.getProductId() == Info.getProductId()) {
-            Configuration.Bookmarks[b.first] = Info;
-            Info.index_ = b.first;
-            return;
-        }
+    auto State = LoadBookmarks();
+    if (!State) {
+        return false;
     }
-
-    size_t index = Configuration.Bookmarks.size();
-    Configuration.Bookmarks[index] = Info;
-    Info.index_ = index;
-    return;
+    Info.index_ = State->put(Info);
+    return Info.index_ >= 0;
 }
 
 bool CreatePrivateKeyFile(std::shared_ptr<nabto::client::Context> Context)
 {
     std::string PrivateKey = Context->createPrivateKey();
-    return WriteStringToFile(PrivateKey, Configuration.KeyFilePath);
+    return WriteStringToFile(PrivateKey, KeyFilePath());
 }
 
 bool GetPrivateKey(std::shared_ptr<nabto::client::Context> Context, string& Out)
 {
-    if (!FileExists(Configuration.KeyFilePath)) {
-        if (!CreatePrivateKeyFile(Context)) {
-            std::cerr << "The private key file " << Configuration.KeyFilePath << " does not exist and could not be generated. " << std::endl;
+    string Path = KeyFilePath();
+    FileStamp Stamp = StatFile(Path);
+    if (!Stamp.exists) {
+        std::lock_guard<std::mutex> lock(GenerateMutex);
+        if (!StatFile(Path).exists && !CreatePrivateKeyFile(Context)) {
+            std::cerr << "The private key file " << Path << " does not exist and could not be generated. " << std::endl;
             return false;
         }
+        Stamp = StatFile(Path);
     }
-    return ReadEntireFileZeroTerminated(Configuration.KeyFilePath, Out);
+
+    std::shared_ptr<const string> Cached = KeyCache.find(Path, Stamp);
+    if (!Cached) {
+        auto Key = std::make_shared<string>();
+        if (!ReadEntireFileZeroTerminated(Path, *Key)) {
+            return false;
+        }
+        Cached = Key;
+        KeyCache.store(Path, Stamp, Cached);
+    }
+    Out = *Cached;
+    return true;
+}
+
+BookmarksSnapshot GetBookMarks()
+{
+    auto Bookmarks = CurrentBookmarks();
+    return BookmarksSnapshot(Bookmarks, &Bookmarks->all());
 }
 
-std::map<int, Configuration::DeviceInfo> PrintBookmarks()
+BookmarksSnapshot PrintBookmarks()
 {   
-    int index = 0;
-    if (Configuration.Bookmarks.empty())
+    BookmarksSnapshot Bookmarks = GetBookMarks();
+    if (Bookmarks->empty())
     {
         std::cout << "No bookmarked devices were found. Maybe you should pair with a few devices?" << std::endl;
+        return Bookmarks;
     }
     std::cout << "The following devices are saved in your bookmarks:" << std::endl;
-    for (auto Bookmark : Configuration.Bookmarks)
+    for (auto& Bookmark : *Bookmarks)
     {
-        std::cout << "[" << index << "] ProductId: " << Bookmark.second.getProductId() << " DeviceId: " << Bookmark.second.getDeviceId() << std::endl;
-        index++;
+        std::cout << "[" << Bookmark.first << "] ProductId: " << Bookmark.second.productId_ << " DeviceId: " << Bookmark.second.deviceId_ << std::endl;
     }
-    return Configuration.Bookmarks;    
+    return Bookmarks;
+
+}
 
+void ExportBookmarks(std::ostream& out)
+{
+    out << BookmarksToDocument(*GetBookMarks()).dump(2) << std::endl;
 }
 
 
 bool DeleteBookmark(const uint32_t& bookmark)
 {
-    if (Configuration.Bookmarks.find(bookmark) == Configuration.Bookmarks.end()) {
+    auto State = LoadBookmarks();
+    if (!State || !State->erase(bookmark)) {
         std::cerr << "The bookmark " << bookmark << " does not exist" << std::endl;
         return false;
     }
-    Configuration.Bookmarks.erase(bookmark);
     return WriteStateFile();
 }
 
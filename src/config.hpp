@@ -1,7 +1,9 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <map>
+#include <functional>
 
 #include <sstream>
 
@@ -30,6 +32,11 @@ const std::string StateFileName = "state/tcp_tunnel_client_state.json";
 const std::string KeyFileName = "keys/client.key";
 
 
+enum class FileEncoding {
+    JSON,
+    CBOR
+};
+
 class DeviceInfo
 {
  public:
@@ -58,30 +65,64 @@ class DeviceInfo
 
 class ClientConfiguration {
  public:
-    ClientConfiguration(const std::string serverUrl)
-        : serverUrl_(serverUrl)
+    ClientConfiguration(const std::string serverUrl, FileEncoding stateEncoding = FileEncoding::JSON)
+        : serverUrl_(serverUrl), stateEncoding_(stateEncoding)
     {
     }
     std::string getServerUrl() { return serverUrl_; }
+    FileEncoding getStateEncoding() { return stateEncoding_; }
  private:
     std::string serverUrl_;
+    FileEncoding stateEncoding_;
 };
 
 void InitializeWithDirectory(const std::string &HomePath);
 std::unique_ptr<ClientConfiguration> GetConfigInfo();
-const char* GetConfigFilePath();
-const char* GetStateFilePath();
+std::string GetConfigFilePath();
+std::string GetStateFilePath();
+// Schedule the bookmark changes to be written in the background.
 bool WriteStateFile();
+// Wait for the scheduled writes, returns false if any of them failed.
+bool SyncStateFile();
+// Call OnChange from a watcher thread when another process changes the bookmarks.
+void WatchBookmarks(std::function<void ()> OnChange);
 std::unique_ptr<DeviceInfo> GetPairedDevice(int Index);
 std::unique_ptr<DeviceInfo> GetPairedDevice(const std::string& fingerprint);
+// Lookup without copying, the device is not changed by later bookmark changes.
+std::shared_ptr<const DeviceInfo> FindPairedDevice(int index);
+std::shared_ptr<const DeviceInfo> FindPairedDevice(const std::string& fingerprint);
+std::shared_ptr<const DeviceInfo> FindPairedDevice(const std::string& productId, const std::string& deviceId);
 bool HasNoBookmarks();
-// insert info into bookmarks, and set the index into the info
-void AddPairedDeviceToBookmarks(DeviceInfo& Info);
+// insert info into bookmarks, and set the index into the info. false if it could not be added
+bool AddPairedDeviceToBookmarks(DeviceInfo& Info);
 bool GetPrivateKey(std::shared_ptr<nabto::client::Context> Context, std::string& PrivateKey);
-std::map<int, Configuration::DeviceInfo> PrintBookmarks();
-std::map<int, Configuration::DeviceInfo> GetBookMarks();
+// Immutable view of the bookmarks, later changes are not visible in it.
+typedef std::shared_ptr<const std::map<int, DeviceInfo> > BookmarksSnapshot;
+BookmarksSnapshot PrintBookmarks();
+// Write the bookmarks as JSON regardless of the state file encoding.
+void ExportBookmarks(std::ostream& out);
+BookmarksSnapshot GetBookMarks();
 bool DeleteBookmark(const uint32_t& bookmark);
 
+// Replace the file atomically, the data is synced to disk before it returns.
+bool WriteStringToFile(const std::string& String, const std::string& Filename);
+// Append without syncing, use SyncFileToDisk to make it durable.
+bool AppendStringToFile(const std::string& String, const std::string& Filename);
+bool SyncFileToDisk(const std::string& Filename);
+bool ReadEntireFileZeroTerminated(const std::string& Filename, std::string& Out);
+
+// Size and modification time of a file, used to detect changes without reading it.
+class FileStamp {
+ public:
+    bool exists = false;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    bool operator==(const FileStamp& other) const {
+        return exists == other.exists && size == other.size && modified == other.modified;
+    }
+};
+FileStamp StatFile(const std::string& Filename);
+
 bool makeDirectories(const std::string& in);
 std::string getDefaultHomeDir();
 
@@ -0,0 +1,353 @@
+#include "connect.hpp"
+
+#include "iam.hpp"
+#include "version.hpp"
+
+#include <nabto/nabto_client_experimental.h>
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+static const std::string appName = "edge_tunnel_client";
+
+static void printMissingClientConfig(const std::string& filename)
+{
+    std::cerr
+        << "The example is missing the client configuration file (" << filename << ")." << std::endl
+        << "The client configuration file is a json file which can be" << std::endl
+        << "used to change the server URL used for remote connections." << std::endl
+        << "In normal scenarios, the file should simply contain an" << std::endl
+        << "empty json document:"
+        << "{" << std::endl
+        << "}" <<std::endl;
+
+}
+
+static void handleFingerprintMismatch(std::shared_ptr<nabto::client::Connection> connection, Configuration::DeviceInfo device)
+{
+    IAM::IAMError ec;
+    std::unique_ptr<IAM::PairingInfo> pairingInfo;
+    std::tie(ec, pairingInfo) = IAM::get_pairing_info(connection);
+    if (ec.ok()) {
+        if (pairingInfo->getProductId() != device.getProductId()) {
+            std::cerr << "The Product ID of the connected device (" <<  pairingInfo->getProductId() << ") does not match the Product ID for the bookmark " << device.getFriendlyName() << std::endl;
+        } else if (pairingInfo->getDeviceId() != device.getDeviceId()) {
+            std::cerr << "The Device ID of the connected device (" <<  pairingInfo->getDeviceId() << ") does not match the Device ID for the bookmark " << device.getFriendlyName() << std::endl;
+        } else {
+            std::cerr << "The public key of the device does not match the public key in the pairing. Repair the device with the client." << std::endl;
+        }
+    } else {
+        // should not happen
+        ec.printError();
+    }
+}
+
+/**
+ * Counts outstanding dials such that the caller can wait for all of
+ * them to finish.
+ */
+class DialBarrier {
+ public:
+    DialBarrier(size_t outstanding)
+        : outstanding_(outstanding)
+    {
+    }
+
+    void done()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_--;
+        if (outstanding_ == 0) {
+            cond_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this](){ return outstanding_ == 0; });
+    }
+
+ private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t outstanding_;
+};
+
+/**
+ * A single connect -> fingerprint check -> /iam/me pipeline. Each
+ * stage is started from the callback of the previous stage so no
+ * thread is blocked while the handshakes are in progress.
+ */
+class DialOperation : public std::enable_shared_from_this<DialOperation> {
+ public:
+    DialOperation(DialResult& result, std::function<void ()> done)
+        : result_(result), done_(done)
+    {
+    }
+
+    void start()
+    {
+        started_ = std::chrono::steady_clock::now();
+        auto self = shared_from_this();
+        try {
+            result_.connection->connect()->callback([self](nabto::client::Status status) {
+                self->connected(status);
+            });
+        } catch (nabto::client::NabtoException& e) {
+            fail(std::string("Connect failed ") + e.what());
+        }
+    }
+
+ private:
+    void connected(nabto::client::Status status)
+    {
+        auto connection = result_.connection;
+        if (!status.ok()) {
+            std::stringstream ss;
+            if (status.getErrorCode() == nabto::client::Status::NO_CHANNELS) {
+                auto localStatus = nabto::client::Status(connection->getLocalChannelErrorCode());
+                auto remoteStatus = nabto::client::Status(connection->getRemoteChannelErrorCode());
+                ss << "Not Connected." << std::endl;
+                ss << " The Local status is: " << localStatus.getDescription() << std::endl;
+                ss << " The Remote status is: " << remoteStatus.getDescription();
+            } else {
+                ss << "Connect failed " << status.getDescription();
+            }
+            result_.retryable = true;
+            fail(ss.str());
+            return;
+        }
+
+        try {
+            if (connection->getDeviceFingerprint() != result_.device.getDeviceFingerprint()) {
+                result_.fingerprintMismatch = true;
+                fail("The device fingerprint does not match the bookmark");
+                return;
+            }
+        } catch (...) {
+            fail("Missing device fingerprint in state, pair with the device again");
+            return;
+        }
+
+        // we are paired if the connection has a user in the device
+        auto self = shared_from_this();
+        IAM::get_me_async(connection, [self](IAM::IAMError ec, std::unique_ptr<IAM::User> user) {
+            if (!user) {
+                if (ec.statusCode() == 0) {
+                    // The request did not get a response, e.g. the connection was closed.
+                    self->result_.retryable = true;
+                    self->fail("Could not get the user from the device");
+                    return;
+                }
+                self->fail("The client is not paired with device, do the pairing again");
+                return;
+            }
+            self->finish(true);
+        });
+    }
+
+    void fail(const std::string& error)
+    {
+        result_.error = error;
+        finish(false);
+    }
+
+    void finish(bool ready)
+    {
+        result_.ready = ready;
+        result_.timeToReady = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_);
+        done_();
+    }
+
+    DialResult& result_;
+    std::function<void ()> done_;
+    std::chrono::steady_clock::time_point started_;
+};
+
+/**
+ * Races a local only dial against a normal dial to the same device. The
+ * first dial which becomes ready is the result and the other connection
+ * is closed. If both fail the result of the normal dial is used, since
+ * its error also covers the remote channel.
+ */
+class DialRace : public std::enable_shared_from_this<DialRace> {
+ public:
+    DialRace(DialResult& result, std::shared_ptr<DialBarrier> barrier)
+        : result_(result), barrier_(barrier)
+    {
+        local_.device = result.device;
+        local_.local = true;
+        remote_.device = result.device;
+    }
+
+    DialResult& local() { return local_; }
+    DialResult& remote() { return remote_; }
+
+    std::function<void ()> done(DialResult& dial)
+    {
+        auto self = shared_from_this();
+        return [self, &dial]() { self->finished(dial); };
+    }
+
+ private:
+    void finished(DialResult& dial)
+    {
+        std::shared_ptr<nabto::client::Connection> loser;
+        bool decided = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+            if (decided_) {
+                // The race is over, this connection is not used.
+                if (dial.ready) {
+                    loser = dial.connection;
+                }
+            } else if (dial.ready || pending_ == 0) {
+                DialResult& other = &dial == &local_ ? remote_ : local_;
+                result_ = dial.ready ? dial : remote_;
+                decided_ = decided = true;
+                if (pending_ > 0) {
+                    loser = other.connection;
+                }
+            }
+        }
+        if (loser) {
+            loser->close();
+        }
+        if (decided) {
+            barrier_->done();
+        }
+    }
+
+    DialResult& result_;
+    std::shared_ptr<DialBarrier> barrier_;
+    DialResult local_;
+    DialResult remote_;
+    std::mutex mutex_;
+    int pending_ = 2;
+    bool decided_ = false;
+};
+
+static std::shared_ptr<nabto::client::Connection> newConnection(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo& device, Configuration::ClientConfiguration& config, const std::string& privateKey)
+{
+    auto connection = context->createConnection();
+    connection->setProductId(device.getProductId());
+    connection->setDeviceId(device.getDeviceId());
+    connection->setApplicationName(appName);
+    connection->setApplicationVersion(edge_tunnel_client_version());
+
+    if (!device.getDirectCandidate().empty()) {
+        connection->enableDirectCandidates();
+        connection->addDirectCandidate(device.getDirectCandidate(), 5592);
+        connection->endOfDirectCandidates();
+    }
+
+    connection->setPrivateKey(privateKey);
+
+    if (!config.getServerUrl().empty()) {
+        connection->setServerUrl(config.getServerUrl());
+    }
+
+    connection->setServerConnectToken(device.getSct());
+    return connection;
+}
+
+std::vector<DialResult> createConnections(std::shared_ptr<nabto::client::Context> context, std::vector<Configuration::DeviceInfo> devices, std::shared_ptr<DeviceDiscovery> discovery)
+{
+    std::vector<DialResult> results(devices.size());
+    if (devices.empty()) {
+        return results;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        results[i].device = devices[i];
+    }
+
+    auto Config = Configuration::GetConfigInfo();
+    if (!Config) {
+        printMissingClientConfig(Configuration::GetConfigFilePath());
+        for (auto& r : results) {
+            r.error = "Missing client configuration";
+        }
+        return results;
+    }
+
+    std::string privateKey;
+    if(!Configuration::GetPrivateKey(context, privateKey)) {
+        for (auto& r : results) {
+            r.error = "Missing private key";
+        }
+        return results;
+    }
+
+    std::vector<std::shared_ptr<DialOperation> > operations;
+    auto barrier = std::make_shared<DialBarrier>(devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        auto& device = devices[i];
+        auto& result = results[i];
+
+        DiscoveredDevice discovered;
+        if (discovery && discovery->find(device.getProductId(), device.getDeviceId(), discovered)) {
+            // The device is on the local network, mDNS does not tell its
+            // address so the native client finds it through a local only
+            // connection.
+            auto race = std::make_shared<DialRace>(result, barrier);
+            race->local().connection = newConnection(context, device, *Config, privateKey);
+            nlohmann::json options;
+            options["Remote"] = false;
+            race->local().connection->setOptions(options.dump());
+            race->remote().connection = newConnection(context, device, *Config, privateKey);
+            operations.push_back(std::make_shared<DialOperation>(race->local(), race->done(race->local())));
+            operations.push_back(std::make_shared<DialOperation>(race->remote(), race->done(race->remote())));
+            continue;
+        }
+
+        result.connection = newConnection(context, device, *Config, privateKey);
+        operations.push_back(std::make_shared<DialOperation>(result, [barrier]() { barrier->done(); }));
+    }
+
+    for (auto op : operations) {
+        op->start();
+    }
+    barrier->wait();
+    return results;
+}
+
+std::shared_ptr<nabto::client::Connection> reportDialResult(DialResult& result)
+{
+    if (result.ready) {
+        std::cout << "Connected to " << result.device.getFriendlyName() << " in " << result.timeToReady.count() << "ms" << (result.local ? " on the local network" : "") << std::endl;
+        return result.connection;
+    }
+
+    if (result.fingerprintMismatch) {
+        handleFingerprintMismatch(result.connection, result.device);
+    } else {
+        std::cerr << result.device.getFriendlyName() << ": " << result.error << std::endl;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<nabto::client::Connection> createConnection(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device, std::shared_ptr<DeviceDiscovery> discovery)
+{
+    auto results = createConnections(context, { device }, discovery);
+    return reportDialResult(results[0]);
+}
+
+void closeConnection(std::shared_ptr<nabto::client::Connection> connection, std::chrono::milliseconds timeout)
+{
+    try {
+        auto future = connection->close();
+        if (!future->waitFor(timeout)) {
+            connection->stop();
+        }
+        future->waitForResult();
+    } catch (nabto::client::NabtoException& e) {
+        // the connection is already closed or it has been stopped.
+    }
+}
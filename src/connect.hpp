@@ -0,0 +1,58 @@
+#pragma once
+
+#include "config.hpp"
+#include "device_discovery.hpp"
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The outcome of connecting to a single bookmarked device.
+ *
+ * A connection is ready when it is connected, the device fingerprint
+ * matches the bookmark and the client is a paired user on the device.
+ */
+class DialResult {
+ public:
+    Configuration::DeviceInfo device;
+    std::shared_ptr<nabto::client::Connection> connection;
+    bool ready = false;
+    bool fingerprintMismatch = false;
+    // true if the dial failed for reasons which could go away by trying again, e.g. the device is offline.
+    bool retryable = false;
+    std::string error;
+    // time from the connect was started until the connection was validated or failed.
+    std::chrono::milliseconds timeToReady = std::chrono::milliseconds(0);
+    // true if the connection was made by the local only dial of a race.
+    bool local = false;
+};
+
+/**
+ * Connect to all the devices concurrently. The connect, fingerprint
+ * check and /iam/me validation is run through future callbacks such
+ * that the total time tracks the slowest device and not the sum.
+ *
+ * If a discovery service is given, a device which it has found on the
+ * local network is dialed twice, with a local only connection and with
+ * a normal connection, and the first connection which is ready is used.
+ *
+ * The results are returned in the same order as the devices.
+ */
+std::vector<DialResult> createConnections(std::shared_ptr<nabto::client::Context> context, std::vector<Configuration::DeviceInfo> devices, std::shared_ptr<DeviceDiscovery> discovery = nullptr);
+
+/**
+ * Print the outcome of a dial and return the connection if it is ready.
+ */
+std::shared_ptr<nabto::client::Connection> reportDialResult(DialResult& result);
+
+std::shared_ptr<nabto::client::Connection> createConnection(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device, std::shared_ptr<DeviceDiscovery> discovery = nullptr);
+
+/**
+ * Close a connection gracefully, the connection is stopped if the close
+ * does not finish within the timeout.
+ */
+void closeConnection(std::shared_ptr<nabto::client::Connection> connection, std::chrono::milliseconds timeout);
@@ -0,0 +1,539 @@
+#include "connection_metrics.hpp"
+
+#include <nabto/nabto_client.h>
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+// A device which does not answer the probe within this time counts as a failed probe.
+static const std::chrono::milliseconds probeTimeout = std::chrono::milliseconds(5000);
+
+class ConnectionMetrics::Probe {
+ public:
+    std::shared_ptr<nabto::client::Connection> connection;
+    std::shared_ptr<nabto::client::Coap> coap;
+    bool hasType = false;
+    nabto::client::Connection::Type type = nabto::client::Connection::RELAY;
+    std::chrono::steady_clock::time_point started;
+    // Set by the future callback before done is called.
+    std::chrono::steady_clock::time_point finished;
+    bool answered = false;
+};
+
+/**
+ * Counts the probes of a sampling round which have not finished.
+ */
+class ProbeRound {
+ public:
+    void add()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_++;
+    }
+
+    void done()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_--;
+        if (outstanding_ == 0) {
+            cond_.notify_all();
+        }
+    }
+
+    // Returns false if some probes have not finished at the deadline.
+    bool waitUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cond_.wait_until(lock, deadline, [this]() { return outstanding_ == 0; });
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return outstanding_ == 0; });
+    }
+
+ private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t outstanding_ = 0;
+};
+
+class ConnectionMetrics::ChannelListener : public nabto::client::ConnectionEventsCallback {
+ public:
+    ChannelListener(std::weak_ptr<ConnectionMetrics> metrics)
+        : metrics_(metrics)
+    {
+    }
+
+    // Called with the connection locked, the channel type is read by the next sample.
+    void onEvent(int event) {
+        if (event == NABTO_CLIENT_CONNECTION_EVENT_CHANNEL_CHANGED) {
+            auto metrics = metrics_.lock();
+            if (metrics) {
+                metrics->channelChanged();
+            }
+        }
+    }
+ private:
+    std::weak_ptr<ConnectionMetrics> metrics_;
+};
+
+ConnectionMetrics::ConnectionMetrics(Configuration::DeviceInfo device, std::weak_ptr<MetricsRegistry> registry)
+    : device_(device), registry_(registry)
+{
+}
+
+void ConnectionMetrics::connected(std::shared_ptr<nabto::client::Connection> connection, std::chrono::milliseconds connectDuration)
+{
+    bool hasType = false;
+    nabto::client::Connection::Type type = nabto::client::Connection::RELAY;
+    try {
+        type = connection->getType();
+        hasType = true;
+    } catch (nabto::client::NabtoException& e) {
+        // sampled again later.
+    }
+    auto listener = std::make_shared<ChannelListener>(shared_from_this());
+    connection->addEventsListener(listener);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection_ = connection;
+    listener_ = listener;
+    hasType_ = hasType;
+    type_ = type;
+    lastSample_ = std::chrono::steady_clock::now();
+    connectDuration_ = connectDuration;
+    rttSeconds_ = -1;
+    connects_++;
+}
+
+void ConnectionMetrics::disconnected()
+{
+    std::shared_ptr<nabto::client::Connection> connection;
+    std::shared_ptr<ChannelListener> listener;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        accumulateLocked(std::chrono::steady_clock::now());
+        connection = std::move(connection_);
+        listener = std::move(listener_);
+        hasType_ = false;
+        rttSeconds_ = -1;
+    }
+    // The listener takes the metrics lock with the connection locked, so
+    // the connection is not called with the metrics locked.
+    if (connection && listener) {
+        connection->removeEventsListener(listener);
+    }
+}
+
+std::shared_ptr<ConnectionMetrics::Probe> ConnectionMetrics::startProbe(std::function<void ()> done)
+{
+    auto probe = std::make_shared<Probe>();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        probe->connection = connection_;
+    }
+    if (!probe->connection) {
+        return nullptr;
+    }
+
+    try {
+        probe->type = probe->connection->getType();
+        probe->hasType = true;
+    } catch (nabto::client::NabtoException& e) {
+        // the connection is closing.
+    }
+
+    std::shared_ptr<nabto::client::FutureVoid> future;
+    probe->started = std::chrono::steady_clock::now();
+    try {
+        probe->coap = probe->connection->createCoap("GET", "/iam/me");
+        if (probe->coap) {
+            future = probe->coap->execute();
+        }
+    } catch (nabto::client::NabtoException& e) {
+        future = nullptr;
+    }
+    if (!future) {
+        // counted as a failed probe.
+        done();
+        return probe;
+    }
+
+    // Any response is a round trip, the status code does not matter.
+    std::weak_ptr<Probe> weakProbe = probe;
+    future->callback([weakProbe, done](nabto::client::Status status) {
+        auto probe = weakProbe.lock();
+        if (probe) {
+            probe->finished = std::chrono::steady_clock::now();
+            probe->answered = status.ok();
+        }
+        done();
+    });
+    return probe;
+}
+
+void ConnectionMetrics::finishProbe(std::shared_ptr<Probe> probe)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connection_ != probe->connection) {
+        // The connection was replaced while probing.
+        return;
+    }
+    accumulateLocked(std::chrono::steady_clock::now());
+    if (probe->hasType) {
+        hasType_ = true;
+        type_ = probe->type;
+    }
+    if (probe->answered) {
+        rttSeconds_ = std::chrono::duration<double>(probe->finished - probe->started).count();
+    } else {
+        probeFailures_++;
+    }
+}
+
+void ConnectionMetrics::channelChanged()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channelChanges_++;
+    }
+    auto registry = registry_.lock();
+    if (registry) {
+        registry->wakeUp();
+    }
+}
+
+void ConnectionMetrics::accumulateLocked(std::chrono::steady_clock::time_point now)
+{
+    if (connection_ && hasType_) {
+        double elapsed = std::chrono::duration<double>(now - lastSample_).count();
+        if (type_ == nabto::client::Connection::DIRECT) {
+            directSeconds_ += elapsed;
+        } else {
+            relaySeconds_ += elapsed;
+        }
+    }
+    lastSample_ = now;
+}
+
+ConnectionSnapshot ConnectionMetrics::snapshot()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    accumulateLocked(std::chrono::steady_clock::now());
+    ConnectionSnapshot s;
+    s.device = device_.getFriendlyName();
+    s.deviceFingerprint = device_.getDeviceFingerprint();
+    s.connected = connection_ != nullptr;
+    if (connection_ && hasType_) {
+        s.channel = type_ == nabto::client::Connection::DIRECT ? "direct" : "relay";
+    }
+    s.connectDuration = connectDuration_;
+    s.rttSeconds = rttSeconds_;
+    s.connects = connects_;
+    s.channelChanges = channelChanges_;
+    s.probeFailures = probeFailures_;
+    s.relaySeconds = relaySeconds_;
+    s.directSeconds = directSeconds_;
+    return s;
+}
+
+TunnelCounters::TunnelCounters(Configuration::DeviceInfo device, const std::string& service)
+    : device_(device), service_(service), bytesUp_(0), bytesDown_(0)
+{
+}
+
+void TunnelCounters::sessionOpened()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    activeSessions_++;
+    sessions_++;
+}
+
+void TunnelCounters::sessionClosed(std::chrono::steady_clock::duration duration, bool error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    activeSessions_--;
+    sessionSeconds_ += std::chrono::duration<double>(duration).count();
+    if (error) {
+        sessionErrors_++;
+    }
+}
+
+TunnelSnapshot TunnelCounters::snapshot()
+{
+    TunnelSnapshot s;
+    s.device = device_.getFriendlyName();
+    s.deviceFingerprint = device_.getDeviceFingerprint();
+    s.service = service_;
+    s.bytesUp = bytesUp_;
+    s.bytesDown = bytesDown_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.activeSessions = activeSessions_;
+    s.sessions = sessions_;
+    s.sessionErrors = sessionErrors_;
+    s.sessionSeconds = sessionSeconds_;
+    return s;
+}
+
+bool TunnelCounters::isFor(const std::string& deviceFingerprint, const std::string& service)
+{
+    return device_.getDeviceFingerprint() == deviceFingerprint && service_ == service;
+}
+
+MetricsRegistry::MetricsRegistry(const std::string& exportPath, MetricsFormat format, std::chrono::milliseconds interval)
+    : exportPath_(exportPath), format_(format), interval_(interval)
+{
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    stop();
+}
+
+std::shared_ptr<ConnectionMetrics> MetricsRegistry::track(Configuration::DeviceInfo device)
+{
+    auto metrics = std::make_shared<ConnectionMetrics>(device, shared_from_this());
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(metrics);
+    return metrics;
+}
+
+std::shared_ptr<TunnelCounters> MetricsRegistry::trackTunnel(Configuration::DeviceInfo device, const std::string& service)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& t : tunnels_) {
+        if (t->isFor(device.getDeviceFingerprint(), service)) {
+            return t;
+        }
+    }
+    auto counters = std::make_shared<TunnelCounters>(device, service);
+    tunnels_.push_back(counters);
+    return counters;
+}
+
+std::string MetricsRegistry::exportJson()
+{
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections;
+    std::vector<std::shared_ptr<TunnelCounters> > tunnels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections = connections_;
+        tunnels = tunnels_;
+    }
+    nlohmann::json out;
+    out["Connections"] = nlohmann::json::array();
+    for (auto& c : connections) {
+        auto s = c->snapshot();
+        nlohmann::json entry;
+        entry["Device"] = s.device;
+        entry["DeviceFingerprint"] = s.deviceFingerprint;
+        entry["Connected"] = s.connected;
+        entry["Channel"] = s.channel;
+        entry["ConnectMs"] = s.connectDuration.count();
+        if (s.rttSeconds >= 0) {
+            entry["RttMs"] = s.rttSeconds * 1000;
+        }
+        entry["Connects"] = s.connects;
+        entry["ChannelChanges"] = s.channelChanges;
+        entry["ProbeFailures"] = s.probeFailures;
+        entry["RelaySeconds"] = s.relaySeconds;
+        entry["DirectSeconds"] = s.directSeconds;
+        out["Connections"].push_back(entry);
+    }
+    out["Tunnels"] = nlohmann::json::array();
+    for (auto& t : tunnels) {
+        auto s = t->snapshot();
+        nlohmann::json entry;
+        entry["Device"] = s.device;
+        entry["DeviceFingerprint"] = s.deviceFingerprint;
+        entry["Service"] = s.service;
+        entry["BytesUp"] = s.bytesUp;
+        entry["BytesDown"] = s.bytesDown;
+        entry["ActiveSessions"] = s.activeSessions;
+        entry["Sessions"] = s.sessions;
+        entry["SessionErrors"] = s.sessionErrors;
+        entry["SessionSeconds"] = s.sessionSeconds;
+        out["Tunnels"].push_back(entry);
+    }
+    return out.dump(2) + "\n";
+}
+
+static std::string escapeLabel(const std::string& in)
+{
+    std::string out;
+    for (char c : in) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string MetricsRegistry::exportPrometheus()
+{
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections;
+    std::vector<std::shared_ptr<TunnelCounters> > tunnels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections = connections_;
+        tunnels = tunnels_;
+    }
+    std::vector<ConnectionSnapshot> snapshots;
+    for (auto& c : connections) {
+        snapshots.push_back(c->snapshot());
+    }
+    std::vector<TunnelSnapshot> tunnelSnapshots;
+    for (auto& t : tunnels) {
+        tunnelSnapshots.push_back(t->snapshot());
+    }
+
+    std::stringstream out;
+    out << std::setprecision(12);
+    auto metric = [&](const std::string& name, const std::string& type, const std::string& help, std::function<bool (const ConnectionSnapshot& s, double& value)> get) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+        for (auto& s : snapshots) {
+            double value;
+            if (get(s, value)) {
+                out << name << "{device=\"" << escapeLabel(s.device) << "\",fingerprint=\"" << escapeLabel(s.deviceFingerprint) << "\"} " << value << "\n";
+            }
+        }
+    };
+
+    metric("edge_tunnel_connection_up", "gauge", "1 if the device is connected.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.connected ? 1 : 0; return true; });
+    metric("edge_tunnel_connection_direct", "gauge", "1 if the connection uses a direct channel, 0 if it is relayed.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.channel == "direct" ? 1 : 0; return !s.channel.empty(); });
+    metric("edge_tunnel_connection_rtt_seconds", "gauge", "Round trip time of the last CoAP probe.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.rttSeconds; return s.rttSeconds >= 0; });
+    metric("edge_tunnel_connection_connect_seconds", "gauge", "Time it took to make and validate the last connection.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.connectDuration.count() / 1000.0; return s.connects > 0; });
+    metric("edge_tunnel_connection_connects_total", "counter", "Connections made to the device.",
+           [](const ConnectionSnapshot& s, double& v) { v = (double)s.connects; return true; });
+    metric("edge_tunnel_connection_channel_changes_total", "counter", "Channel changes reported by the client library.",
+           [](const ConnectionSnapshot& s, double& v) { v = (double)s.channelChanges; return true; });
+    metric("edge_tunnel_connection_probe_failures_total", "counter", "CoAP probes which got no response.",
+           [](const ConnectionSnapshot& s, double& v) { v = (double)s.probeFailures; return true; });
+    metric("edge_tunnel_connection_relay_seconds_total", "counter", "Time connected through a relay.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.relaySeconds; return true; });
+    metric("edge_tunnel_connection_direct_seconds_total", "counter", "Time connected on a direct channel.",
+           [](const ConnectionSnapshot& s, double& v) { v = s.directSeconds; return true; });
+
+    auto tunnelMetric = [&](const std::string& name, const std::string& type, const std::string& help, std::function<double (const TunnelSnapshot& s)> get) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+        for (auto& s : tunnelSnapshots) {
+            out << name << "{device=\"" << escapeLabel(s.device) << "\",fingerprint=\"" << escapeLabel(s.deviceFingerprint) << "\",service=\"" << escapeLabel(s.service) << "\"} " << get(s) << "\n";
+        }
+    };
+
+    tunnelMetric("edge_tunnel_tunnel_bytes_up_total", "counter", "Bytes sent from the local clients to the device.",
+                 [](const TunnelSnapshot& s) { return (double)s.bytesUp; });
+    tunnelMetric("edge_tunnel_tunnel_bytes_down_total", "counter", "Bytes sent from the device to the local clients.",
+                 [](const TunnelSnapshot& s) { return (double)s.bytesDown; });
+    tunnelMetric("edge_tunnel_tunnel_active_sessions", "gauge", "Open TCP sessions through the tunnel.",
+                 [](const TunnelSnapshot& s) { return (double)s.activeSessions; });
+    tunnelMetric("edge_tunnel_tunnel_sessions_total", "counter", "TCP sessions accepted for the tunnel.",
+                 [](const TunnelSnapshot& s) { return (double)s.sessions; });
+    tunnelMetric("edge_tunnel_tunnel_session_errors_total", "counter", "TCP sessions which could not be forwarded or failed.",
+                 [](const TunnelSnapshot& s) { return (double)s.sessionErrors; });
+    tunnelMetric("edge_tunnel_tunnel_session_seconds_total", "counter", "Total duration of the closed TCP sessions.",
+                 [](const TunnelSnapshot& s) { return s.sessionSeconds; });
+    return out.str();
+}
+
+std::string MetricsRegistry::exportAs(MetricsFormat format)
+{
+    return format == MetricsFormat::JSON ? exportJson() : exportPrometheus();
+}
+
+void MetricsRegistry::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (thread_.joinable() || stopped_) {
+        return;
+    }
+    thread_ = std::thread([this]() { run(); });
+}
+
+void MetricsRegistry::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void MetricsRegistry::wakeUp()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    wakeUp_ = true;
+    cond_.notify_all();
+}
+
+void MetricsRegistry::run()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait_for(lock, interval_, [this]() { return stopped_ || wakeUp_; });
+            if (stopped_) {
+                break;
+            }
+            wakeUp_ = false;
+        }
+        sampleAll();
+        if (!exportPath_.empty()) {
+            Configuration::WriteStringToFile(exportAs(format_), exportPath_);
+        }
+    }
+}
+
+void MetricsRegistry::sampleAll()
+{
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections = connections_;
+    }
+
+    // The probes run at the same time, so a round takes at most the probe
+    // timeout however many devices are slow to answer.
+    auto round = std::make_shared<ProbeRound>();
+    std::vector<std::pair<std::shared_ptr<ConnectionMetrics>, std::shared_ptr<ConnectionMetrics::Probe> > > probes;
+    for (auto& c : connections) {
+        round->add();
+        auto probe = c->startProbe([round]() { round->done(); });
+        if (!probe) {
+            round->done();
+            continue;
+        }
+        probes.push_back(std::make_pair(c, probe));
+    }
+    if (!round->waitUntil(std::chrono::steady_clock::now() + probeTimeout)) {
+        for (auto& p : probes) {
+            if (p.second->coap) {
+                p.second->coap->stop();
+            }
+        }
+        round->wait();
+    }
+    for (auto& p : probes) {
+        p.first->finishProbe(p.second);
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <nabto_client.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MetricsRegistry;
+
+// The metrics of a connection at one point in time.
+class ConnectionSnapshot {
+ public:
+    std::string device;
+    std::string deviceFingerprint;
+    bool connected = false;
+    // "direct", "relay" or empty if the channel has not been sampled.
+    std::string channel;
+    std::chrono::milliseconds connectDuration = std::chrono::milliseconds(0);
+    // Negative if no probe has succeeded on the current connection.
+    double rttSeconds = -1;
+    uint64_t connects = 0;
+    uint64_t channelChanges = 0;
+    uint64_t probeFailures = 0;
+    double relaySeconds = 0;
+    double directSeconds = 0;
+};
+
+/**
+ * Metrics of the connection to a single device.
+ *
+ * The connect duration and the channel changes are recorded when they
+ * happen. The channel type and the round trip time are sampled by the
+ * MetricsRegistry, the round trip time is measured with a CoAP request
+ * to the device. The time spent on a relay and on a direct channel is
+ * accumulated between samples.
+ */
+class ConnectionMetrics : public std::enable_shared_from_this<ConnectionMetrics> {
+ public:
+    ConnectionMetrics(Configuration::DeviceInfo device, std::weak_ptr<MetricsRegistry> registry);
+
+    // Called when the connection is ready, connectDuration is the time until it was validated.
+    void connected(std::shared_ptr<nabto::client::Connection> connection, std::chrono::milliseconds connectDuration);
+    void disconnected();
+
+    class Probe;
+
+    /**
+     * Read the channel type and start a CoAP probe of the round trip
+     * time. done is called once the probe has finished, also if it could
+     * not be started. Returns null without calling done if there is no
+     * connection.
+     */
+    std::shared_ptr<Probe> startProbe(std::function<void ()> done);
+
+    // Record the outcome of a probe after its done function was called.
+    void finishProbe(std::shared_ptr<Probe> probe);
+
+    ConnectionSnapshot snapshot();
+
+ private:
+    class ChannelListener;
+
+    void channelChanged();
+    // Add the time since the last sample to the current channel, called with the mutex held.
+    void accumulateLocked(std::chrono::steady_clock::time_point now);
+
+    Configuration::DeviceInfo device_;
+    std::weak_ptr<MetricsRegistry> registry_;
+
+    std::mutex mutex_;
+    std::shared_ptr<nabto::client::Connection> connection_;
+    std::shared_ptr<ChannelListener> listener_;
+    bool hasType_ = false;
+    nabto::client::Connection::Type type_ = nabto::client::Connection::RELAY;
+    std::chrono::steady_clock::time_point lastSample_;
+    std::chrono::milliseconds connectDuration_ = std::chrono::milliseconds(0);
+    double rttSeconds_ = -1;
+    uint64_t connects_ = 0;
+    uint64_t channelChanges_ = 0;
+    uint64_t probeFailures_ = 0;
+    double relaySeconds_ = 0;
+    double directSeconds_ = 0;
+};
+
+// The counters of a tunnel at one point in time.
+class TunnelSnapshot {
+ public:
+    std::string device;
+    std::string deviceFingerprint;
+    std::string service;
+    uint64_t bytesUp = 0;
+    uint64_t bytesDown = 0;
+    uint64_t activeSessions = 0;
+    uint64_t sessions = 0;
+    uint64_t sessionErrors = 0;
+    double sessionSeconds = 0;
+};
+
+/**
+ * Counters of the TCP sessions through a tunnel. Up is from the local
+ * client to the device. The byte counters are updated for every read,
+ * they are atomic so sessions do not contend on a lock.
+ */
+class TunnelCounters {
+ public:
+    TunnelCounters(Configuration::DeviceInfo device, const std::string& service);
+
+    void sessionOpened();
+    // error is true if the session could not be forwarded or ended with a socket error.
+    void sessionClosed(std::chrono::steady_clock::duration duration, bool error);
+    void addBytesUp(uint64_t n) { bytesUp_ += n; }
+    void addBytesDown(uint64_t n) { bytesDown_ += n; }
+
+    TunnelSnapshot snapshot();
+    bool isFor(const std::string& deviceFingerprint, const std::string& service);
+
+ private:
+    Configuration::DeviceInfo device_;
+    std::string service_;
+    std::atomic<uint64_t> bytesUp_;
+    std::atomic<uint64_t> bytesDown_;
+
+    std::mutex mutex_;
+    uint64_t activeSessions_ = 0;
+    uint64_t sessions_ = 0;
+    uint64_t sessionErrors_ = 0;
+    double sessionSeconds_ = 0;
+};
+
+enum class MetricsFormat {
+    JSON,
+    PROMETHEUS
+};
+
+/**
+ * The metrics of all the connections and tunnels of the process. A
+ * sampler thread samples the connections periodically, and right after
+ * a channel change, and writes the metrics to the export file if one is
+ * given.
+ */
+class MetricsRegistry : public std::enable_shared_from_this<MetricsRegistry> {
+ public:
+    MetricsRegistry(const std::string& exportPath, MetricsFormat format, std::chrono::milliseconds interval = std::chrono::seconds(15));
+    ~MetricsRegistry();
+
+    std::shared_ptr<ConnectionMetrics> track(Configuration::DeviceInfo device);
+    // Tunnels to the same service on a device share their counters.
+    std::shared_ptr<TunnelCounters> trackTunnel(Configuration::DeviceInfo device, const std::string& service);
+
+    std::string exportJson();
+    std::string exportPrometheus();
+    std::string exportAs(MetricsFormat format);
+
+    void start();
+    void stop();
+
+    // Sample the connections before the next interval, e.g. after a channel change.
+    void wakeUp();
+
+ private:
+    void run();
+    void sampleAll();
+
+    std::string exportPath_;
+    MetricsFormat format_;
+    std::chrono::milliseconds interval_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::shared_ptr<ConnectionMetrics> > connections_;
+    std::vector<std::shared_ptr<TunnelCounters> > tunnels_;
+    bool wakeUp_ = false;
+    bool stopped_ = false;
+    std::thread thread_;
+};
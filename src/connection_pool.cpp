@@ -0,0 +1,211 @@
+#include "connection_pool.hpp"
+
+#include "connect.hpp"
+
+#include <nabto/nabto_client.h>
+
+#include <algorithm>
+#include <vector>
+
+// Connections which are in use are checked again after this long at the
+// least, they cannot time out before they are released.
+static const std::chrono::milliseconds minReapInterval = std::chrono::milliseconds(100);
+
+class ConnectionPool::CloseListener : public nabto::client::ConnectionEventsCallback {
+ public:
+    CloseListener(std::weak_ptr<ConnectionPool> pool, const std::string& deviceFingerprint, nabto::client::Connection* connection)
+        : pool_(pool), deviceFingerprint_(deviceFingerprint), connection_(connection)
+    {
+    }
+
+    void onEvent(int event) {
+        if (event == NABTO_CLIENT_CONNECTION_EVENT_CLOSED) {
+            auto pool = pool_.lock();
+            if (pool) {
+                pool->connectionClosed(deviceFingerprint_, connection_);
+            }
+        }
+    }
+ private:
+    std::weak_ptr<ConnectionPool> pool_;
+    std::string deviceFingerprint_;
+    nabto::client::Connection* connection_;
+};
+
+std::shared_ptr<ConnectionPool> ConnectionPool::create(std::shared_ptr<nabto::client::Context> context, std::chrono::milliseconds idleTimeout, std::shared_ptr<DeviceDiscovery> discovery)
+{
+    return std::make_shared<ConnectionPool>(context, idleTimeout, discovery);
+}
+
+ConnectionPool::ConnectionPool(std::shared_ptr<nabto::client::Context> context, std::chrono::milliseconds idleTimeout, std::shared_ptr<DeviceDiscovery> discovery)
+    : context_(context), idleTimeout_(idleTimeout), discovery_(discovery)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+std::shared_ptr<nabto::client::Connection> ConnectionPool::get(Configuration::DeviceInfo device)
+{
+    closeIdle();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(device.getDeviceFingerprint());
+        if (it != entries_.end()) {
+            it->second.lastUsed = std::chrono::steady_clock::now();
+            return it->second.connection;
+        }
+    }
+
+    auto results = createConnections(context_, { device }, discovery_);
+    auto connection = reportDialResult(results[0]);
+    if (!connection) {
+        return nullptr;
+    }
+    put(device.getDeviceFingerprint(), connection);
+
+    // Another thread could have connected to the device at the same time, use the pooled connection.
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(device.getDeviceFingerprint());
+    if (it != entries_.end()) {
+        return it->second.connection;
+    }
+    return connection;
+}
+
+std::shared_ptr<nabto::client::Connection> ConnectionPool::find(const std::string& deviceFingerprint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(deviceFingerprint);
+    if (it == entries_.end()) {
+        return nullptr;
+    }
+    it->second.lastUsed = std::chrono::steady_clock::now();
+    return it->second.connection;
+}
+
+void ConnectionPool::put(const std::string& deviceFingerprint, std::shared_ptr<nabto::client::Connection> connection)
+{
+    closeIdle();
+    auto listener = std::make_shared<CloseListener>(shared_from_this(), deviceFingerprint, connection.get());
+    connection->addEventsListener(listener);
+
+    Entry entry;
+    entry.connection = connection;
+    entry.listener = listener;
+    entry.lastUsed = std::chrono::steady_clock::now();
+
+    bool added = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(deviceFingerprint);
+        if (it == entries_.end()) {
+            entries_[deviceFingerprint] = entry;
+            added = true;
+            if (!thread_.joinable()) {
+                thread_ = std::thread(&ConnectionPool::run, this);
+            }
+        } else if (it->second.connection == connection) {
+            it->second.lastUsed = entry.lastUsed;
+        }
+    }
+    if (!added) {
+        // The pool already has this or another connection to the device, keep the pooled one.
+        connection->removeEventsListener(listener);
+    }
+}
+
+void ConnectionPool::evict(const std::string& deviceFingerprint)
+{
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(deviceFingerprint);
+        if (it == entries_.end()) {
+            return;
+        }
+        entry = it->second;
+        entries_.erase(it);
+    }
+    close(entry);
+}
+
+void ConnectionPool::closeIdle()
+{
+    std::vector<Entry> idle;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            // A connection which is held outside the pool is in use.
+            bool unused = it->second.connection.use_count() == 1;
+            if (unused && now - it->second.lastUsed >= idleTimeout_) {
+                idle.push_back(it->second);
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& entry : idle) {
+        close(entry);
+    }
+}
+
+void ConnectionPool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+        // Sleep until the first unused connection times out.
+        auto now = std::chrono::steady_clock::now();
+        auto wakeup = now + std::max(idleTimeout_, minReapInterval);
+        for (auto& e : entries_) {
+            if (e.second.connection.use_count() == 1) {
+                wakeup = std::min(wakeup, e.second.lastUsed + idleTimeout_);
+            }
+        }
+        if (cond_.wait_until(lock, wakeup, [this]() { return stopped_; })) {
+            return;
+        }
+        lock.unlock();
+        closeIdle();
+        lock.lock();
+    }
+}
+
+size_t ConnectionPool::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void ConnectionPool::connectionClosed(const std::string& deviceFingerprint, nabto::client::Connection* connection)
+{
+    // Called from the events callback, the listener cannot be removed
+    // from here as the connection holds its events lock.
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(deviceFingerprint);
+    if (it != entries_.end() && it->second.connection.get() == connection) {
+        entries_.erase(it);
+    }
+}
+
+void ConnectionPool::close(Entry& entry)
+{
+    entry.connection->removeEventsListener(entry.listener);
+    try {
+        // The close completes in the background.
+        entry.connection->close();
+    } catch (nabto::client::NabtoException& e) {
+        // already closed.
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "config.hpp"
+#include "device_discovery.hpp"
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Shares live connections between the operations on a device.
+ *
+ * Connections are keyed by the device fingerprint. A connection which
+ * is closed by the device is evicted when the CLOSED event arrives, and
+ * connections which nobody outside the pool uses are closed by a
+ * background thread once they have been idle for the idle timeout. With a discovery service new
+ * connections to devices on the local network race a local only dial,
+ * see createConnections.
+ */
+class ConnectionPool : public std::enable_shared_from_this<ConnectionPool> {
+ public:
+    static std::shared_ptr<ConnectionPool> create(std::shared_ptr<nabto::client::Context> context, std::chrono::milliseconds idleTimeout = std::chrono::minutes(5), std::shared_ptr<DeviceDiscovery> discovery = nullptr);
+
+    ConnectionPool(std::shared_ptr<nabto::client::Context> context, std::chrono::milliseconds idleTimeout, std::shared_ptr<DeviceDiscovery> discovery = nullptr);
+    ~ConnectionPool();
+
+    /**
+     * Get a connection to the device. A pooled connection is reused if
+     * it is still open, otherwise a new connection is made and validated.
+     * Returns nullptr and prints the reason if the device is unreachable.
+     */
+    std::shared_ptr<nabto::client::Connection> get(Configuration::DeviceInfo device);
+
+    /**
+     * Get the pooled connection to the device without connecting,
+     * nullptr if the pool has no connection to the device.
+     */
+    std::shared_ptr<nabto::client::Connection> find(const std::string& deviceFingerprint);
+
+    /**
+     * Add a connected and paired connection to the pool, e.g. the
+     * connection which was used for pairing.
+     */
+    void put(const std::string& deviceFingerprint, std::shared_ptr<nabto::client::Connection> connection);
+
+    /**
+     * Remove the connection to the device from the pool and close it.
+     */
+    void evict(const std::string& deviceFingerprint);
+
+    /**
+     * Close the connections which have been idle for the idle timeout.
+     * The background thread does this when a connection times out, it
+     * is also done on every get and put.
+     */
+    void closeIdle();
+
+    size_t size();
+
+ private:
+    class CloseListener;
+
+    class Entry {
+     public:
+        std::shared_ptr<nabto::client::Connection> connection;
+        std::shared_ptr<CloseListener> listener;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    void connectionClosed(const std::string& deviceFingerprint, nabto::client::Connection* connection);
+    void close(Entry& entry);
+    void run();
+
+    std::shared_ptr<nabto::client::Context> context_;
+    std::chrono::milliseconds idleTimeout_;
+    std::shared_ptr<DeviceDiscovery> discovery_;
+
+    // Connection functions are never called with the mutex held since
+    // the events callbacks run with the connection lock held.
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+
+    // Started when the first connection is added.
+    std::thread thread_;
+    std::condition_variable cond_;
+    bool stopped_ = false;
+};
@@ -0,0 +1,147 @@
+#include "device_discovery.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+std::shared_ptr<DeviceDiscovery> DeviceDiscovery::create(std::shared_ptr<nabto::client::Context> context, const std::string& subtype)
+{
+    return std::make_shared<DeviceDiscovery>(context, subtype);
+}
+
+DeviceDiscovery::DeviceDiscovery(std::shared_ptr<nabto::client::Context> context, const std::string& subtype)
+    : resolver_(context->createMdnsResolver(subtype)), started_(std::chrono::steady_clock::now())
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+DeviceDiscovery::~DeviceDiscovery()
+{
+    stop();
+}
+
+void DeviceDiscovery::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    // Resolves the pending result with an error, which ends the thread.
+    resolver_->stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+std::vector<DiscoveredDevice> DeviceDiscovery::devices(std::chrono::milliseconds settleTime)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_until(lock, started_ + settleTime, [this]() { return stopped_; });
+    return devicesLocked();
+}
+
+std::vector<DiscoveredDevice> DeviceDiscovery::devicesLocked()
+{
+    std::vector<DiscoveredDevice> result;
+    for (auto& d : devices_) {
+        result.push_back(d.second.device);
+    }
+    return result;
+}
+
+DeviceDiscovery::Predicate DeviceDiscovery::hasDevices(size_t count)
+{
+    return [count](const std::vector<DiscoveredDevice>& devices) {
+        return devices.size() >= count;
+    };
+}
+
+std::vector<DiscoveredDevice> DeviceDiscovery::waitFor(Predicate predicate, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<DiscoveredDevice> result = devicesLocked();
+    cond_.wait_for(lock, timeout, [&]() {
+        result = devicesLocked();
+        return stopped_ || predicate(result);
+    });
+    return result;
+}
+
+bool DeviceDiscovery::find(const std::string& productId, const std::string& deviceId, DiscoveredDevice& device)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = devices_.find(ProductDeviceId(productId, deviceId));
+    if (it == devices_.end()) {
+        return false;
+    }
+    device = it->second.device;
+    return true;
+}
+
+void DeviceDiscovery::run()
+{
+    try {
+        for (;;) {
+            handle(resolver_->getResult()->waitForResult());
+        }
+    } catch (nabto::client::NabtoException& e) {
+        // The resolver has been stopped.
+    }
+}
+
+void DeviceDiscovery::handle(std::shared_ptr<nabto::client::MdnsResult> result)
+{
+    std::string instance = result->getServiceInstanceName();
+
+    if (result->getAction() == nabto::client::MdnsResult::REMOVE) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = instances_.find(instance);
+        if (it == instances_.end()) {
+            return;
+        }
+        auto device = devices_.find(it->second);
+        if (device != devices_.end()) {
+            device->second.instances.erase(instance);
+            if (device->second.instances.empty()) {
+                devices_.erase(device);
+            }
+        }
+        instances_.erase(it);
+        cond_.notify_all();
+        return;
+    }
+
+    DiscoveredDevice device;
+    device.productId = result->getProductId();
+    device.deviceId = result->getDeviceId();
+    if (device.productId.empty() || device.deviceId.empty()) {
+        return;
+    }
+    try {
+        auto txtItems = nlohmann::json::parse(result->getTxtItems());
+        device.friendlyName = txtItems["fn"].get<std::string>();
+    } catch (std::exception& e) {
+        // fine the name is optional.
+    }
+
+    ProductDeviceId id(device.productId, device.deviceId);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto previous = instances_.find(instance);
+    if (previous != instances_.end() && previous->second != id) {
+        // The instance name is now used by another device.
+        auto old = devices_.find(previous->second);
+        if (old != devices_.end()) {
+            old->second.instances.erase(instance);
+            if (old->second.instances.empty()) {
+                devices_.erase(old);
+            }
+        }
+    }
+    instances_[instance] = id;
+    Entry& entry = devices_[id];
+    entry.device = device;
+    entry.instances.insert(instance);
+    cond_.notify_all();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DiscoveredDevice {
+ public:
+    std::string productId;
+    std::string deviceId;
+    // The fn txt item, empty if the device does not announce a name.
+    std::string friendlyName;
+};
+
+/**
+ * Keeps an mDNS resolver running and maintains the table of the local
+ * devices it has found.
+ *
+ * Devices are added and updated when they are announced, and removed
+ * when all the service instances of a device have been withdrawn, so
+ * the same device found over both ipv4 and ipv6 is listed once. Lookups
+ * are answered from the table, only the first lookup has to wait for
+ * the devices to answer.
+ */
+class DeviceDiscovery {
+ public:
+    static std::shared_ptr<DeviceDiscovery> create(std::shared_ptr<nabto::client::Context> context, const std::string& subtype = "");
+
+    DeviceDiscovery(std::shared_ptr<nabto::client::Context> context, const std::string& subtype);
+    ~DeviceDiscovery();
+
+    /**
+     * The devices found so far, ordered by product and device id. If the
+     * resolver was started less than settleTime ago this waits until it
+     * has been running that long, such that the devices on the network
+     * have had time to answer.
+     */
+    std::vector<DiscoveredDevice> devices(std::chrono::milliseconds settleTime = std::chrono::milliseconds(0));
+
+    // Tells whether the devices found so far are all that is needed.
+    typedef std::function<bool (const std::vector<DiscoveredDevice>& devices)> Predicate;
+    static Predicate hasDevices(size_t count);
+
+    /**
+     * Wait until the predicate holds for the devices found so far, or
+     * until the timeout. Returns the devices found at that time. The
+     * predicate is evaluated with the table locked whenever it changes.
+     */
+    std::vector<DiscoveredDevice> waitFor(Predicate predicate, std::chrono::milliseconds timeout);
+
+    /**
+     * Look up a device in the table without waiting.
+     */
+    bool find(const std::string& productId, const std::string& deviceId, DiscoveredDevice& device);
+
+    /**
+     * Stop the resolver, the table is not changed after this.
+     */
+    void stop();
+
+ private:
+    typedef std::pair<std::string, std::string> ProductDeviceId;
+
+    class Entry {
+     public:
+        DiscoveredDevice device;
+        std::set<std::string> instances;
+    };
+
+    void run();
+    void handle(std::shared_ptr<nabto::client::MdnsResult> result);
+    std::vector<DiscoveredDevice> devicesLocked();
+
+    std::shared_ptr<nabto::client::MdnsResolver> resolver_;
+    std::chrono::steady_clock::time_point started_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::map<ProductDeviceId, Entry> devices_;
+    // The device of each service instance, the remove results only carry the instance name.
+    std::map<std::string, ProductDeviceId> instances_;
+    bool stopped_ = false;
+
+    std::thread thread_;
+};
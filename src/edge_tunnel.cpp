@@ -3,6 +3,12 @@
 #include <map>
 
 #include "pairing.hpp"
+#include "coap_batch.hpp"
+#include "connect.hpp"
+#include "tunnel_supervisor.hpp"
+#include "tunnel_daemon.hpp"
+#include "connection_metrics.hpp"
+#include "metrics_server.hpp"
 #include "config.hpp"
 #include "timestamp.hpp"
 #include "iam.hpp"
@@ -22,18 +28,18 @@
 #include <stdio.h>
 #include <thread>
 #include <future>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include "MainWindow.h"
 
 using json = nlohmann::json;
 
-const std::string appName = "edge_tunnel_client";
-
 enum {
   COAP_CONTENT_FORMAT_APPLICATION_CBOR = 60
 };
 
-// TODO reconnect when connection is closed.
-
 std::string generalHelp = R"(This client application is designed to be used with a tcp tunnel
 device application. The functionality of the system is to enable
 tunnelling of TCP connections over the internet. The system allows a
@@ -66,140 +72,54 @@ class MyLogger : public nabto::client::Logger
     }
 };
 
-std::shared_ptr<nabto::client::Connection> connection_;
+// A signal handler may only set a lock free atomic, it is read by the
+// SignalWatcher thread.
+std::atomic<int> caughtSignal_(0);
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the signal flag has to be lock free");
 
 void signalHandler(int s){
-    printf("Caught signal %d\n",s);
-    if (connection_) {
-        connection_->close()->waitForResult();
-    }
-}
-
-static void printMissingClientConfig(const std::string& filename)
-{
-    std::cerr
-        << "The example is missing the client configuration file (" << filename << ")." << std::endl
-        << "The client configuration file is a json file which can be" << std::endl
-        << "used to change the server URL used for remote connections." << std::endl
-        << "In normal scenarios, the file should simply contain an" << std::endl
-        << "empty json document:"
-        << "{" << std::endl
-        << "}" <<std::endl;
-
+    caughtSignal_ = s;
 }
 
-class CloseListener : public nabto::client::ConnectionEventsCallback {
+/**
+ * Calls stop from a normal thread once a signal has been caught, since
+ * stopping takes locks which the interrupted thread may hold.
+ */
+class SignalWatcher {
  public:
-
-    CloseListener() {
-    }
-    void onEvent(int event) {
-        if (event == NABTO_CLIENT_CONNECTION_EVENT_CLOSED) {
-            std::cout << "Connection closed, closing application" << std::endl;
-            promise_.set_value();
-            return;
-        }
+    SignalWatcher(std::function<void ()> stop)
+    {
+        caughtSignal_ = 0;
+        thread_ = std::thread([this, stop]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!done_) {
+                if (caughtSignal_ != 0) {
+                    std::cout << "Caught signal " << caughtSignal_ << std::endl;
+                    stop();
+                    return;
+                }
+                cond_.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        });
     }
 
-    void waitForClose() {
-        auto future = promise_.get_future();
-        future.get();
+    ~SignalWatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
     }
 
  private:
-    std::promise<void> promise_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool done_ = false;
+    std::thread thread_;
 };
 
-void handleFingerprintMismatch(std::shared_ptr<nabto::client::Connection> connection, Configuration::DeviceInfo device)
-{
-    IAM::IAMError ec;
-    std::unique_ptr<IAM::PairingInfo> pairingInfo;
-    std::tie(ec, pairingInfo) = IAM::get_pairing_info(connection);
-    if (ec.ok()) {
-        if (pairingInfo->getProductId() != device.getProductId()) {
-            std::cerr << "The Product ID of the connected device (" <<  pairingInfo->getProductId() << ") does not match the Product ID for the bookmark " << device.getFriendlyName() << std::endl;
-        } else if (pairingInfo->getDeviceId() != device.getDeviceId()) {
-            std::cerr << "The Device ID of the connected device (" <<  pairingInfo->getDeviceId() << ") does not match the Device ID for the bookmark " << device.getFriendlyName() << std::endl;
-        } else {
-            std::cerr << "The public key of the device does not match the public key in the pairing. Repair the device with the client." << std::endl;
-        }
-    } else {
-        // should not happen
-        ec.printError();
-    }
-}
-
-std::shared_ptr<nabto::client::Connection> createConnection(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device)
-{
-    auto Config = Configuration::GetConfigInfo();
-    if (!Config) {
-        printMissingClientConfig(Configuration::GetConfigFilePath());
-        return nullptr;
-    }
-
-    auto connection = context->createConnection();
-    connection->setProductId(device.getProductId());
-    connection->setDeviceId(device.getDeviceId());
-    connection->setApplicationName(appName);
-    connection->setApplicationVersion(edge_tunnel_client_version());
-
-    if (!device.getDirectCandidate().empty()) {
-        connection->enableDirectCandidates();
-        connection->addDirectCandidate(device.getDirectCandidate(), 5592);
-        connection->endOfDirectCandidates();
-    }
-
-    std::string privateKey;
-    if(!Configuration::GetPrivateKey(context, privateKey)) {
-        return nullptr;
-    }
-    connection->setPrivateKey(privateKey);
-
-
-    if (!Config->getServerUrl().empty()) {
-        connection->setServerUrl(Config->getServerUrl());
-    }
-
-    connection->setServerConnectToken(device.getSct());
-
-    try {
-        connection->connect()->waitForResult();
-    } catch (nabto::client::NabtoException& e) {
-        if (e.status().getErrorCode() == nabto::client::Status::NO_CHANNELS) {
-            auto localStatus = nabto::client::Status(connection->getLocalChannelErrorCode());
-            auto remoteStatus = nabto::client::Status(connection->getRemoteChannelErrorCode());
-            std::cerr << "Not Connected." << std::endl;
-            std::cerr << " The Local status is: " << localStatus.getDescription() << std::endl;
-            std::cerr << " The Remote status is: " << remoteStatus.getDescription() << std::endl;
-        } else {
-            std::cerr << "Connect failed " << e.what() << std::endl;
-        }
-        return nullptr;
-    }
-
-    try {
-        if (connection->getDeviceFingerprint() != device.getDeviceFingerprint()) {
-            handleFingerprintMismatch(connection, device);
-            return nullptr;
-        }
-    } catch (...) {
-        std::cerr << "Missing device fingerprint in state, pair with the device again" << std::endl;
-        return nullptr;
-    }
-
-    // we are paired if the connection has a user in the device
-    IAM::IAMError ec;
-    std::unique_ptr<IAM::User> user;
-    std::tie(ec, user) = IAM::get_me(connection);
-
-    if (!user) {
-        std::cerr << "The client is not paired with device, do the pairing again" << std::endl;
-        return nullptr;
-    }
-    return connection;
-}
-
-static void get_service(std::shared_ptr<nabto::client::Connection> connection, const std::string& service);
 static void print_service(const nlohmann::json& service);
 
 bool list_services(std::shared_ptr<nabto::client::Connection> connection)
@@ -213,14 +133,35 @@ bool list_services(std::shared_ptr<nabto::client::Connection> connection)
         auto data = json::from_cbor(cbor);
         if (data.is_array()) {
             std::cout << "Available services ..." << std::endl;
+            bool ok = true;
             try {
+                CoapBatch batch(connection);
+                std::vector<std::string> ids;
                 for (auto s : data) {
-                    get_service(connection, s.get<std::string>());
+                    ids.push_back(s.get<std::string>());
+                    batch.add("GET", "/tcp-tunnels/services/" + ids.back());
+                }
+                // The results are in the order the requests were added.
+                auto results = batch.execute();
+                for (size_t i = 0; i < results.size(); i++) {
+                    auto& result = results[i];
+                    if (!result.status.ok()) {
+                        std::cerr << "Could not get the service " << ids[i] << ": " << result.status.getDescription() << std::endl;
+                        ok = false;
+                    } else if (result.coap->getResponseStatusCode() != 205 ||
+                               result.coap->getResponseContentFormat() != COAP_CONTENT_FORMAT_APPLICATION_CBOR)
+                    {
+                        std::cerr << "Could not get the service " << ids[i] << ", status code " << result.coap->getResponseStatusCode() << std::endl;
+                        ok = false;
+                    } else {
+                        print_service(json::from_cbor(result.coap->getResponsePayload()));
+                    }
                 }
             } catch(std::exception& e) {
                 std::cerr << "Failed to get services: " << e.what() << std::endl;
                 return false;
             }
+            return ok;
         }
         return true;
     } else {
@@ -229,19 +170,6 @@ bool list_services(std::shared_ptr<nabto::client::Connection> connection)
     }
 }
 
-void get_service(std::shared_ptr<nabto::client::Connection> connection, const std::string& service)
-{
-    auto coap = connection->createCoap("GET", "/tcp-tunnels/services/" + service);
-    coap->execute()->waitForResult();
-    if (coap->getResponseStatusCode() == 205 &&
-        coap->getResponseContentFormat() == COAP_CONTENT_FORMAT_APPLICATION_CBOR)
-    {
-        auto cbor = coap->getResponsePayload();
-        auto data = json::from_cbor(cbor);
-        print_service(data);
-    }
-}
-
 std::string constant_width_string(std::string in) {
     const size_t maxLength = 10;
     if (in.size() > maxLength) {
@@ -280,41 +208,61 @@ bool split_in_service_and_port(const std::string& in, std::string& service, uint
     return true;
 }
 
-bool tcptunnel(std::shared_ptr<nabto::client::Connection> connection, std::vector<std::string> services)
+bool tcptunnel(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device, std::vector<std::string> services)
 {
-    std::vector<std::shared_ptr<nabto::client::TcpTunnel> > tunnels;
+    std::vector<TunnelSpec> tunnels;
 
     for (auto serviceAndPort : services) {
-        std::string service;
-        uint16_t localPort;
-        if (!split_in_service_and_port(serviceAndPort, service, localPort)) {
+        TunnelSpec spec;
+        if (!split_in_service_and_port(serviceAndPort, spec.service, spec.localPort)) {
             return false;
         }
+        tunnels.push_back(spec);
+    }
 
-        std::shared_ptr<nabto::client::TcpTunnel> tunnel;
-        try {
-            tunnel = connection->createTcpTunnel();
-            tunnel->open(service, localPort)->waitForResult();
-        } catch (std::exception& e) {
-            std::cout << "Failed to open a tunnel to " << serviceAndPort << " error: " << e.what() << std::endl;
+    auto supervisor = std::make_shared<TunnelSupervisor>(context, device, tunnels);
+
+    // run until ctrl c, reconnecting when the connection is closed.
+    SignalWatcher watcher([supervisor]() { supervisor->stop(); });
+    signal(SIGINT, &signalHandler);
+
+    return supervisor->run();
+}
+
+bool run_daemon(const std::string& manifest, const std::string& logLevel, const std::string& metricsFile, MetricsFormat metricsFormat, int metricsPort)
+{
+    auto context = nabto::client::Context::create();
+    context->setLogger(std::make_shared<MyLogger>());
+    context->setLogLevel(logLevel);
+
+    std::shared_ptr<MetricsRegistry> metrics;
+    if (!metricsFile.empty() || metricsPort >= 0) {
+        metrics = std::make_shared<MetricsRegistry>(metricsFile, metricsFormat);
+    }
+
+    auto daemon = std::make_shared<TunnelDaemon>(context, metrics);
+    if (!daemon->loadManifest(manifest)) {
+        return false;
+    }
+    if (metrics) {
+        metrics->start();
+    }
+    std::unique_ptr<MetricsServer> metricsServer;
+    if (metricsPort >= 0) {
+        metricsServer.reset(new MetricsServer(metrics));
+        if (!metricsServer->start((uint16_t)metricsPort)) {
+            std::cerr << "Cannot serve the metrics on the local port " << metricsPort << std::endl;
             return false;
         }
-
-        std::cout << "TCP Tunnel opened for the service " << service << " listening on the local port " << tunnel->getLocalPort() << std::endl;
-        tunnels.push_back(tunnel);
+        std::cout << "Metrics are served on http://127.0.0.1:" << metricsServer->getPort() << "/metrics" << std::endl;
     }
 
-    // wait for ctrl c
+    // run until ctrl c or sigterm, each device is reconnected on its own.
+    SignalWatcher watcher([daemon]() { daemon->stop(); });
     signal(SIGINT, &signalHandler);
+    signal(SIGTERM, &signalHandler);
 
-    auto closeListener = std::make_shared<CloseListener>();
-    connection->addEventsListener(closeListener);
-    connection_ = connection;
-
-    closeListener->waitForClose();
-    connection->removeEventsListener(closeListener);
-    connection_.reset();
-    return true;
+    return daemon->run();
 }
 
 void printDeviceInfo(std::shared_ptr<IAM::PairingInfo> pi)
@@ -339,9 +287,85 @@ void printDeviceInfo(std::shared_ptr<IAM::PairingInfo> pi)
 
 int main(int argc, char** argv){
 
-    QApplication a(argc, argv);
+    cxxopts::Options options("edge_tunnel_client", "Nabto Edge TCP tunnel client");
+    options.allow_unrecognised_options();
+    options.add_options()
+        ("h,help", "Show help")
+        ("H,home-dir", "Set alternative home directory", cxxopts::value<std::string>())
+        ("daemon", "Run without the GUI and keep the tunnels in the manifest file open", cxxopts::value<std::string>())
+        ("log-level", "Log level used in daemon mode (error|warn|info|trace)", cxxopts::value<std::string>()->default_value("error"))
+        ("metrics-file", "Write connection metrics to this file in daemon mode", cxxopts::value<std::string>())
+        ("metrics-format", "Format of the metrics file (prometheus|json)", cxxopts::value<std::string>()->default_value("prometheus"))
+        ("metrics-port", "Serve the metrics over HTTP on this port on 127.0.0.1 in daemon mode, 0 picks a free port", cxxopts::value<int>())
+        ("export-state", "Print the bookmarks as JSON and exit");
+
     std::string homeDir = Configuration::getDefaultHomeDir();
+    std::string daemonManifest;
+    std::string logLevel;
+    std::string metricsFile;
+    std::string metricsFormat;
+    int metricsPort = -1;
+    bool exportState = false;
+    // cxxopts rewrites the arguments it parses and reads Qt options such
+    // as -style fusion as groups of short options, so it gets a copy
+    // without them and Qt gets the original arguments.
+    std::vector<char*> optionArgs;
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i > 0 && arg.size() > 2 && arg[0] == '-' && arg[1] != '-') {
+            continue;
+        }
+        optionArgs.push_back(argv[i]);
+    }
+    int optionArgc = (int)optionArgs.size();
+    char** optionArgv = optionArgs.data();
+    try {
+        auto result = options.parse(optionArgc, optionArgv);
+        if (result.count("help")) {
+            std::cout << options.help() << std::endl;
+            PrintGeneralHelp();
+            return 0;
+        }
+        if (result.count("home-dir")) {
+            homeDir = result["home-dir"].as<std::string>();
+        }
+        if (result.count("daemon")) {
+            daemonManifest = result["daemon"].as<std::string>();
+        }
+        logLevel = result["log-level"].as<std::string>();
+        if (result.count("metrics-file")) {
+            metricsFile = result["metrics-file"].as<std::string>();
+        }
+        metricsFormat = result["metrics-format"].as<std::string>();
+        if (metricsFormat != "prometheus" && metricsFormat != "json") {
+            std::cerr << "The metrics format has to be prometheus or json" << std::endl;
+            return 1;
+        }
+        if (result.count("metrics-port")) {
+            metricsPort = result["metrics-port"].as<int>();
+            if (metricsPort < 0 || metricsPort > 65535) {
+                std::cerr << "The metrics port has to be between 0 and 65535" << std::endl;
+                return 1;
+            }
+        }
+        exportState = result.count("export-state") > 0;
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Error parsing options: " << e.what() << std::endl;
+        return 1;
+    }
+
     Configuration::InitializeWithDirectory(homeDir);
+
+    if (exportState) {
+        Configuration::ExportBookmarks(std::cout);
+        return 0;
+    }
+
+    if (!daemonManifest.empty()) {
+        return run_daemon(daemonManifest, logLevel, metricsFile, metricsFormat == "json" ? MetricsFormat::JSON : MetricsFormat::PROMETHEUS, metricsPort) ? 0 : 1;
+    }
+
+    QApplication a(argc, argv);
     QTranslator translator;
     const QStringList uiLanguages = QLocale::system().uiLanguages();
     for (const QString &locale : uiLanguages) {
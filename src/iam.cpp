@@ -1,4 +1,5 @@
 #include "iam.hpp"
+#include <nabto_client_async.hpp>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -183,6 +184,43 @@ std::pair<IAMError, std::unique_ptr<User> > get_user_path(std::shared_ptr<nabto:
         return std::make_pair(IAMError(e), nullptr);
     }
 }
+void get_user_path_async(std::shared_ptr<nabto::client::Connection> connection, const std::string& path, std::function<void (IAMError, std::unique_ptr<User>)> cb)
+{
+    std::shared_ptr<nabto::client::Coap> coap;
+    std::shared_ptr<nabto::client::FutureVoid> future;
+    try {
+        coap = connection->createCoap("GET", path);
+        future = coap->execute();
+    } catch (nabto::client::NabtoException& e) {
+        cb(IAMError(e), nullptr);
+        return;
+    }
+
+    // The coap request is captured such that it lives until the future resolves.
+    nabto::client::then(future, [coap, cb](nabto::client::Status status) {
+        if (!status.ok()) {
+            cb(IAMError(nabto::client::NabtoException(status)), nullptr);
+            return;
+        }
+        try {
+            int responseCode = coap->getResponseStatusCode();
+            if (responseCode == 205) {
+                json user = json::from_cbor(coap->getResponsePayload());
+                auto decoded = User::create(user);
+                if (decoded != nullptr) {
+                    cb(IAMError(), std::move(decoded));
+                    return;
+                }
+            }
+            cb(IAMError(coap), nullptr);
+        } catch (nabto::client::NabtoException& e) {
+            cb(IAMError(e), nullptr);
+        } catch (nlohmann::json::exception& e) {
+            cb(IAMError(e), nullptr);
+        }
+    });
+}
+
 std::pair<IAMError, std::unique_ptr<User> > get_user(std::shared_ptr<nabto::client::Connection> connection, const std::string& username)
 {
     std::string path = "/iam/users/" + username;
@@ -194,6 +232,11 @@ std::pair<IAMError, std::unique_ptr<User> > get_me(std::shared_ptr<nabto::client
     return get_user_path(connection, "/iam/me");
 }
 
+void get_me_async(std::shared_ptr<nabto::client::Connection> connection, std::function<void (IAMError, std::unique_ptr<User>)> cb)
+{
+    get_user_path_async(connection, "/iam/me", cb);
+}
+
 std::pair<IAMError, std::set<std::string> > get_roles(
     std::shared_ptr<nabto::client::Connection> connection)
 {
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <set>
 #include <vector>
+#include <functional>
 
 #include <nlohmann/json.hpp>
 
@@ -108,6 +109,8 @@ IAMError set_role(std::shared_ptr<nabto::client::Connection> connection, const s
 IAMError set_password(std::shared_ptr<nabto::client::Connection> connection, const std::string& user, const std::string& password);
 std::pair<IAMError, std::unique_ptr<User> > create_user(std::shared_ptr<nabto::client::Connection> connection, const std::string &username);
 std::pair<IAMError, std::unique_ptr<User> > get_me(std::shared_ptr<nabto::client::Connection> connection);
+// Non blocking variant of get_me, the callback is invoked from the nabto client callback thread.
+void get_me_async(std::shared_ptr<nabto::client::Connection> connection, std::function<void (IAMError, std::unique_ptr<User>)> cb);
 std::pair<IAMError, std::unique_ptr<PairingInfo> > get_pairing_info(std::shared_ptr<nabto::client::Connection> connection);
 IAMError set_settings_password_open_pairing(std::shared_ptr<nabto::client::Connection> connection, bool enabled);
 IAMError set_settings_local_open_pairing(std::shared_ptr<nabto::client::Connection> connection, bool enabled);
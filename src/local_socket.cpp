@@ -0,0 +1,168 @@
+#include "local_socket.hpp"
+
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace LocalSocket {
+
+#if defined(_WIN32)
+const socket_type invalid = INVALID_SOCKET;
+#else
+const socket_type invalid = -1;
+#endif
+
+static void initialize()
+{
+#if defined(_WIN32)
+    static std::once_flag once;
+    std::call_once(once, []() {
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+    });
+#endif
+}
+
+// Writing to a socket closed by the peer must fail instead of raising
+// SIGPIPE, sendAll uses MSG_NOSIGNAL where it exists.
+static socket_type noSigpipe(socket_type s)
+{
+#if defined(SO_NOSIGPIPE)
+    if (s != invalid) {
+        int yes = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+    }
+#endif
+    return s;
+}
+
+static sockaddr_in loopback(uint16_t port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+socket_type listen(uint16_t port)
+{
+    initialize();
+    socket_type s = noSigpipe(::socket(AF_INET, SOCK_STREAM, 0));
+    if (s == invalid) {
+        return invalid;
+    }
+#if !defined(_WIN32)
+    // Rebinding the port while old sessions are in TIME_WAIT is fine.
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+#endif
+    sockaddr_in addr = loopback(port);
+    if (::bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(s, 16) != 0) {
+        close(s);
+        return invalid;
+    }
+    return s;
+}
+
+uint16_t localPort(socket_type s)
+{
+    sockaddr_in addr = {};
+    socklen_t length = sizeof(addr);
+    if (getsockname(s, (sockaddr*)&addr, &length) != 0) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+socket_type accept(socket_type listener)
+{
+    return noSigpipe(::accept(listener, nullptr, nullptr));
+}
+
+socket_type connect(uint16_t port)
+{
+    initialize();
+    socket_type s = noSigpipe(::socket(AF_INET, SOCK_STREAM, 0));
+    if (s == invalid) {
+        return invalid;
+    }
+    sockaddr_in addr = loopback(port);
+    if (::connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(s);
+        return invalid;
+    }
+    return s;
+}
+
+bool waitReadable(const socket_type* sockets, bool* readable, size_t count, std::chrono::milliseconds timeout)
+{
+    std::vector<pollfd> fds(count);
+    for (size_t i = 0; i < count; i++) {
+        fds[i].fd = sockets[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+#if defined(_WIN32)
+    int n = WSAPoll(fds.data(), (ULONG)count, (INT)timeout.count());
+#else
+    int n = ::poll(fds.data(), count, (int)timeout.count());
+#endif
+    for (size_t i = 0; i < count; i++) {
+        // A hang up or an error is seen by the next receive.
+        readable[i] = n > 0 && fds[i].revents != 0;
+    }
+    return n > 0;
+}
+
+int64_t receive(socket_type s, uint8_t* buffer, size_t size)
+{
+    return ::recv(s, (char*)buffer, (int)size, 0);
+}
+
+bool sendAll(socket_type s, const uint8_t* data, size_t size)
+{
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    while (size > 0) {
+        auto sent = ::send(s, (const char*)data, (int)size, flags);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+void shutdownWrite(socket_type s)
+{
+#if defined(_WIN32)
+    ::shutdown(s, SD_SEND);
+#else
+    ::shutdown(s, SHUT_WR);
+#endif
+}
+
+void close(socket_type s)
+{
+#if defined(_WIN32)
+    ::closesocket(s);
+#else
+    ::close(s);
+#endif
+}
+
+} // namespace
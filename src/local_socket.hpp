@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+typedef SOCKET socket_type;
+#else
+typedef int socket_type;
+#endif
+
+/**
+ * Blocking TCP sockets on the loopback interface, used for the local
+ * side of the counted tunnels and for the metrics endpoint.
+ */
+namespace LocalSocket {
+
+extern const socket_type invalid;
+
+// Listen on 127.0.0.1, port 0 picks a free port. Returns invalid on failure.
+socket_type listen(uint16_t port);
+uint16_t localPort(socket_type s);
+socket_type accept(socket_type listener);
+socket_type connect(uint16_t port);
+
+/**
+ * Wait until one of the sockets is readable or the timeout expires.
+ * readable is set for each socket, returns false on timeout or error.
+ */
+bool waitReadable(const socket_type* sockets, bool* readable, size_t count, std::chrono::milliseconds timeout);
+
+// The number of bytes read, 0 at the end of the stream and -1 on errors.
+int64_t receive(socket_type s, uint8_t* buffer, size_t size);
+bool sendAll(socket_type s, const uint8_t* data, size_t size);
+void shutdownWrite(socket_type s);
+void close(socket_type s);
+
+} // namespace
@@ -0,0 +1,125 @@
+#include "metrics_server.hpp"
+
+#include <sstream>
+#include <string>
+
+static const std::chrono::milliseconds pollInterval = std::chrono::milliseconds(250);
+// A client which has not sent its request within this time is dropped.
+static const std::chrono::milliseconds requestTimeout = std::chrono::milliseconds(2000);
+static const size_t maxRequestSize = 8192;
+
+MetricsServer::MetricsServer(std::shared_ptr<MetricsRegistry> registry)
+    : registry_(registry)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(uint16_t port)
+{
+    listener_ = LocalSocket::listen(port);
+    if (listener_ == LocalSocket::invalid) {
+        return false;
+    }
+    port_ = LocalSocket::localPort(listener_);
+    thread_ = std::thread([this]() { run(); });
+    return true;
+}
+
+uint16_t MetricsServer::getPort()
+{
+    return port_;
+}
+
+void MetricsServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (listener_ != LocalSocket::invalid) {
+        LocalSocket::close(listener_);
+        listener_ = LocalSocket::invalid;
+    }
+}
+
+bool MetricsServer::isStopped()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopped_;
+}
+
+void MetricsServer::run()
+{
+    while (!isStopped()) {
+        bool readable = false;
+        if (!LocalSocket::waitReadable(&listener_, &readable, 1, pollInterval)) {
+            continue;
+        }
+        socket_type client = LocalSocket::accept(listener_);
+        if (client == LocalSocket::invalid) {
+            continue;
+        }
+        handle(client);
+        LocalSocket::close(client);
+    }
+}
+
+void MetricsServer::handle(socket_type client)
+{
+    // Only the request line is used, the headers are read and ignored.
+    std::string request;
+    auto deadline = std::chrono::steady_clock::now() + requestTimeout;
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < maxRequestSize) {
+        auto now = std::chrono::steady_clock::now();
+        bool readable = false;
+        if (now >= deadline || !LocalSocket::waitReadable(&client, &readable, 1, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now))) {
+            return;
+        }
+        uint8_t buffer[1024];
+        int64_t n = LocalSocket::receive(client, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return;
+        }
+        request.append((const char*)buffer, (size_t)n);
+    }
+
+    std::string method;
+    std::string path;
+    std::istringstream line(request.substr(0, request.find("\r\n")));
+    line >> method >> path;
+
+    std::string status = "200 OK";
+    std::string contentType;
+    std::string body;
+    if (method != "GET") {
+        status = "405 Method Not Allowed";
+        contentType = "text/plain";
+        body = "Only GET is supported\n";
+    } else if (path == "/metrics") {
+        contentType = "text/plain; version=0.0.4";
+        body = registry_->exportPrometheus();
+    } else if (path == "/metrics.json") {
+        contentType = "application/json";
+        body = registry_->exportJson();
+    } else {
+        status = "404 Not Found";
+        contentType = "text/plain";
+        body = "Use /metrics or /metrics.json\n";
+    }
+
+    std::stringstream response;
+    response << "HTTP/1.0 " << status << "\r\n"
+             << "Content-Type: " << contentType << "\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    std::string out = response.str();
+    LocalSocket::sendAll(client, (const uint8_t*)out.data(), out.size());
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "connection_metrics.hpp"
+#include "local_socket.hpp"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Serves the metrics over HTTP on 127.0.0.1. GET /metrics returns the
+ * Prometheus text format and GET /metrics.json the JSON format. The
+ * requests are answered one at a time by a single thread.
+ */
+class MetricsServer {
+ public:
+    MetricsServer(std::shared_ptr<MetricsRegistry> registry);
+    ~MetricsServer();
+
+    /**
+     * Start listening, port 0 picks a free port. Returns false if the
+     * port cannot be used.
+     */
+    bool start(uint16_t port);
+    uint16_t getPort();
+    void stop();
+
+ private:
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    void run();
+    void handle(socket_type client);
+    bool isStopped();
+
+    std::shared_ptr<MetricsRegistry> registry_;
+    socket_type listener_ = LocalSocket::invalid;
+    uint16_t port_ = 0;
+
+    std::mutex mutex_;
+    bool stopped_ = false;
+    std::thread thread_;
+};
@@ -1,7 +1,6 @@
 #include "pairing.hpp"
 
 #include "config.hpp"
-#include "scanner.hpp"
 #include "iam.hpp"
 #include "iam_interactive.hpp"
 
@@ -11,16 +10,24 @@
 
 using json = nlohmann::json;
 
+static const std::chrono::milliseconds scanTimeout = std::chrono::milliseconds(2000);
+// The devices on a network answer a query close together, the scan ends
+// when no new device has answered for this long.
+static const std::chrono::milliseconds lateAnswerTime = std::chrono::milliseconds(250);
+
 static std::string write_config(Configuration::DeviceInfo& Device);
 
-static std::string write_config(std::shared_ptr<nabto::client::Connection> connection, const std::string& directCandidate = "");
-static std::string interactive_pair_connection(std::shared_ptr<nabto::client::Connection> connection, const std::string& usernameInvite = "", const std::string& password = "");
+static std::string write_config(std::shared_ptr<nabto::client::Connection> connection, std::shared_ptr<ConnectionPool> pool, const std::string& directCandidate = "");
+static std::string interactive_pair_connection(std::shared_ptr<nabto::client::Connection> connection, std::shared_ptr<ConnectionPool> pool, const std::string& usernameInvite = "", const std::string& password = "");
 
-static std::string handle_already_paired(std::shared_ptr<nabto::client::Connection> connection, const std::string& directCandidate = "")
+static std::string handle_already_paired(std::shared_ptr<nabto::client::Connection> connection, std::shared_ptr<ConnectionPool> pool, const std::string& directCandidate = "")
 {
     auto device = Configuration::GetPairedDevice(connection->getDeviceFingerprint());
     std::cout << device.get() << std::endl;
     if (device) {
+        if (pool) {
+            pool->put(device->getDeviceFingerprint(), connection);
+        }
         return "The client is already paired with the device";
     } else {
         return "The client is already paired with the device. However the client does not have the state saved, recreating the client state";
@@ -151,10 +158,22 @@ static bool password_invite_pair(std::shared_ptr<nabto::client::Connection> conn
     return password_invite_pair_password(connection, username, password);
 }
 
-std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context)
+std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context, std::shared_ptr<ConnectionPool> pool, std::shared_ptr<DeviceDiscovery> discovery)
 {
-    std::cout << "Scanning for local devices for 2 seconds." << std::endl;
-    auto devices = nabto::examples::common::Scanner::scan(Context, std::chrono::milliseconds(2000), "tcptunnel");
+    if (!discovery) {
+        std::cout << "Scanning for local devices for up to 2 seconds." << std::endl;
+        discovery = DeviceDiscovery::create(Context, "tcptunnel");
+    }
+    // A long running discovery has its table ready and returns at once.
+    auto deadline = std::chrono::steady_clock::now() + scanTimeout;
+    auto devices = discovery->waitFor(DeviceDiscovery::hasDevices(1), scanTimeout);
+    while (!devices.empty() && std::chrono::steady_clock::now() < deadline) {
+        auto more = discovery->waitFor(DeviceDiscovery::hasDevices(devices.size() + 1), lateAnswerTime);
+        if (more.size() <= devices.size()) {
+            break;
+        }
+        devices = more;
+    }
     if (devices.size() == 0) {
         return "Did not find any local devices, is the device on the same local network as the client?";
     }
@@ -164,11 +183,7 @@ std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context)
     std::cout << "[q]: Quit without pairing" << std::endl;
 
     for (size_t i = 0; i < devices.size(); ++i) {
-        std::string ProductID;
-        std::string DeviceID;
-        std::string fn;
-        std::tie(ProductID, DeviceID, fn) = devices[i];
-        std::cout << "[" << i << "]: ProductId: " << ProductID << " DeviceId: " << DeviceID << " Name: " << fn << std::endl;
+        std::cout << "[" << i << "]: ProductId: " << devices[i].productId << " DeviceId: " << devices[i].deviceId << " Name: " << devices[i].friendlyName << std::endl;
     }
 
     int deviceChoice = IAM::interactive_choice("Choose a device: ", 0, devices.size());
@@ -178,10 +193,8 @@ std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context)
 
     auto connection = Context->createConnection();
     {
-        std::string productId;
-        std::string deviceId;
-        std::string fn;
-        std::tie(productId, deviceId, fn) = devices[deviceChoice];
+        std::string productId = devices[deviceChoice].productId;
+        std::string deviceId = devices[deviceChoice].deviceId;
         connection->setProductId(productId);
         connection->setDeviceId(deviceId);
 
@@ -212,17 +225,17 @@ std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context)
 
         std::cout << "Connected to the device. ProductId: " <<  productId << " DeviceId: " << deviceId << std::endl;
     }
-    return interactive_pair_connection(connection);
+    return interactive_pair_connection(connection, pool);
 }
 
-std::string interactive_pair_connection(std::shared_ptr<nabto::client::Connection> connection, const std::string& usernameInvite, const std::string& password)
+std::string interactive_pair_connection(std::shared_ptr<nabto::client::Connection> connection, std::shared_ptr<ConnectionPool> pool, const std::string& usernameInvite, const std::string& password)
 {
     {
         IAM::IAMError ec;
         std::unique_ptr<IAM::User> user;
         std::tie(ec, user) = IAM::get_me(connection);
         if (user) {
-            return handle_already_paired(connection);
+            return handle_already_paired(connection, pool);
         }
     }
 
@@ -275,7 +288,7 @@ std::string interactive_pair_connection(std::shared_ptr<nabto::client::Connectio
         std::cerr << "No supported pairing modes" << std::endl;
         return "Error";
     }
-    return write_config(connection);
+    return write_config(connection, pool);
 }
 
 static std::vector<std::string> split(const std::string& s, char delimiter)
@@ -306,10 +319,10 @@ static std::map<std::string, std::string> parseStringArgs(const std::string pair
     return args;
 }
 
-std::string param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& productId, const std::string& deviceId, const std::string& usernameInvite, const std::string& password, const std::string& sct);
+std::string param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& productId, const std::string& deviceId, const std::string& usernameInvite, const std::string& password, const std::string& sct, std::shared_ptr<ConnectionPool> pool);
 
 
-std::string string_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& pairingString)
+std::string string_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& pairingString, std::shared_ptr<ConnectionPool> pool)
 {
     std::map<std::string, std::string> args = parseStringArgs(pairingString);
     std::string productId = args["p"];
@@ -319,16 +332,27 @@ std::string string_pair(std::shared_ptr<nabto::client::Context> ctx, const std::
     std::string usernameInvite = args["u"];
     std::cout<<usernameInvite<<std::endl;
 
-    return param_pair(ctx, productId, deviceId, usernameInvite, pairingPassword, sct);
+    return param_pair(ctx, productId, deviceId, usernameInvite, pairingPassword, sct, pool);
 }
 
-std::string param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& productId, const std::string& deviceId, const std::string& usernameInvite, const std::string& pairingPassword, const std::string& sct)
+std::string param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::string& productId, const std::string& deviceId, const std::string& usernameInvite, const std::string& pairingPassword, const std::string& sct, std::shared_ptr<ConnectionPool> pool)
 {
     auto Config = Configuration::GetConfigInfo();
     if (!Config) {
         return "Error";
     }
 
+    if (pool) {
+        // Reuse a live connection if the device is already bookmarked.
+        auto bookmark = Configuration::FindPairedDevice(productId, deviceId);
+        if (bookmark) {
+            auto pooled = pool->find(bookmark->deviceFingerprint_);
+            if (pooled) {
+                return interactive_pair_connection(pooled, pool, usernameInvite, pairingPassword);
+            }
+        }
+    }
+
     auto connection = ctx->createConnection();
     connection->setProductId(productId);
     connection->setDeviceId(deviceId);
@@ -365,10 +389,10 @@ std::string param_pair(std::shared_ptr<nabto::client::Context> ctx, const std::s
 
     std::cout << "Connected to device ProductId: " <<  productId << " DeviceId: " << deviceId << std::endl;
 
-    return interactive_pair_connection(connection, usernameInvite, pairingPassword);
+    return interactive_pair_connection(connection, pool, usernameInvite, pairingPassword);
 }
 
-std::string direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& host)
+std::string direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& host, std::shared_ptr<ConnectionPool> pool)
 {
     auto connection = Context->createConnection();
     std::string privateKey;
@@ -407,10 +431,10 @@ std::string direct_pair(std::shared_ptr<nabto::client::Context> Context, const s
         std::cerr << std::endl;
         return "Could not make a direct connection to the host";
     }
-    return interactive_pair_connection(connection);
+    return interactive_pair_connection(connection, pool);
 }
 
-std::string write_config(std::shared_ptr<nabto::client::Connection> connection, const std::string& host)
+std::string write_config(std::shared_ptr<nabto::client::Connection> connection, std::shared_ptr<ConnectionPool> pool, const std::string& host)
 {
     Configuration::DeviceInfo device;
 
@@ -437,12 +461,17 @@ std::string write_config(std::shared_ptr<nabto::client::Connection> connection,
         return  "Pairing failed";
     }
     device.sct_ = user->getSct();
+    if (pool) {
+        pool->put(device.getDeviceFingerprint(), connection);
+    }
     return write_config(device);
 }
 
 std::string write_config(Configuration::DeviceInfo& device)
 {
-    Configuration::AddPairedDeviceToBookmarks(device);
+    if (!Configuration::AddPairedDeviceToBookmarks(device)) {
+        return "Failed to add the device to the bookmarks";
+    }
 
     std::cout << "The device " << device.getFriendlyName() << " has been set into the bookmarks as index " << device.getIndex() << std::endl;
 
@@ -1,11 +1,16 @@
 #pragma once
+#include "connection_pool.hpp"
+#include "device_discovery.hpp"
+
 #include <nabto_client.hpp>
 #include <string>
 #include <memory>
 #include <set>
 
-std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context);
-std::string string_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& pairString);
-std::string direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& host);
+// If a pool is given the connection to a paired device is put into it such that it can be reused.
+// If a discovery service is given its device table is used instead of scanning for local devices.
+std::string interactive_pair(std::shared_ptr<nabto::client::Context> Context, std::shared_ptr<ConnectionPool> pool = nullptr, std::shared_ptr<DeviceDiscovery> discovery = nullptr);
+std::string string_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& pairString, std::shared_ptr<ConnectionPool> pool = nullptr);
+std::string direct_pair(std::shared_ptr<nabto::client::Context> Context, const std::string& host, std::shared_ptr<ConnectionPool> pool = nullptr);
 
 
@@ -0,0 +1,816 @@
+#include "state_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace Configuration
+{
+
+// Journals smaller than this are never compacted.
+static const size_t minCompactRecords = 64;
+
+const std::chrono::milliseconds StateStore::coalesceDelay(50);
+
+void to_json(json& j, const DeviceInfo& d)
+{
+    j = json({
+            {"DeviceFingerprint", d.deviceFingerprint_},
+            {"DeviceId", d.deviceId_},
+            {"ProductId", d.productId_},
+            {"Sct", d.sct_}
+        });
+    if (!d.directCandidate_.empty()) {
+        j["DirectCandidate"] = d.directCandidate_;
+    }
+}
+
+void from_json(const json& j, DeviceInfo& d)
+{
+    j.at("DeviceFingerprint").get_to(d.deviceFingerprint_);
+    j.at("DeviceId").get_to(d.deviceId_);
+    j.at("ProductId").get_to(d.productId_);
+    j.at("Sct").get_to(d.sct_);
+    try {
+        j.at("DirectCandidate").get_to(d.directCandidate_);
+    } catch (const std::exception& e) {
+        // no direct candidate, fine
+    }
+}
+
+static bool IsJson(const char* begin, const char* end)
+{
+    const char* first = std::find_if(begin, end, [](char c) { return c != ' ' && c != '\t' && c != '\r' && c != '\n'; });
+    return first != end && (*first == '{' || *first == '[');
+}
+
+json DecodeDocument(const char* begin, const char* end)
+{
+    if (IsJson(begin, end)) {
+        return json::parse(begin, end);
+    }
+    return json::from_cbor(begin, end);
+}
+
+std::string EncodeDocument(const json& document, FileEncoding encoding)
+{
+    if (encoding == FileEncoding::CBOR) {
+        std::vector<uint8_t> cbor = json::to_cbor(document);
+        return std::string(cbor.begin(), cbor.end());
+    }
+    return document.dump(2);
+}
+
+json BookmarksToDocument(const std::map<int, DeviceInfo>& bookmarks)
+{
+    json BookmarksArray = json::array();
+    for (auto& Bookmark : bookmarks) {
+        json Device = Bookmark.second;
+        Device["Index"] = Bookmark.first;
+        BookmarksArray.push_back(Device);
+    }
+    return json({ {"devices", BookmarksArray} });
+}
+
+/**
+ * Read only memory mapping of a file. An empty or missing file is
+ * mapped as no data.
+ */
+class MappedFile {
+ public:
+    MappedFile(const std::string& path)
+    {
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+            return;
+        }
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ == NULL) {
+            return;
+        }
+        void* data = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (data != NULL) {
+            data_ = static_cast<const char*>(data);
+            size_ = static_cast<size_t>(size.QuadPart);
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<const char*>(data);
+                size_ = st.st_size;
+            }
+        }
+        // The mapping stays valid after the descriptor is closed.
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if defined(_WIN32)
+        if (data_ != nullptr) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != NULL) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    bool empty() const { return size_ == 0; }
+
+ private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#endif
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * Exclusive advisory lock on the state lock file, held while the state
+ * files are read or changed. Changes are refused if it is not locked.
+ */
+class StateLock {
+ public:
+    StateLock(const std::string& path)
+    {
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ != INVALID_HANDLE_VALUE) {
+            OVERLAPPED overlapped = {};
+            locked_ = LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+        }
+#else
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ >= 0) {
+            int ec;
+            while ((ec = flock(fd_, LOCK_EX)) != 0 && errno == EINTR) {
+            }
+            locked_ = ec == 0;
+        }
+#endif
+        if (!locked_) {
+            std::cerr << "Could not lock " << path << std::endl;
+        }
+    }
+
+    bool locked() const { return locked_; }
+
+    ~StateLock()
+    {
+        // Closing the file releases the lock.
+#if defined(_WIN32)
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+ private:
+    StateLock(const StateLock&) = delete;
+    StateLock& operator=(const StateLock&) = delete;
+
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+    int fd_ = -1;
+#endif
+    bool locked_ = false;
+};
+
+const DeviceInfo* BookmarkTable::find(int index) const
+{
+    auto it = bookmarks_.find(index);
+    if (it == bookmarks_.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const DeviceInfo* BookmarkTable::findByFingerprint(const std::string& fingerprint) const
+{
+    auto it = byFingerprint_.find(fingerprint);
+    if (it == byFingerprint_.end()) {
+        return nullptr;
+    }
+    return find(it->second);
+}
+
+const DeviceInfo* BookmarkTable::findByDeviceId(const std::string& productId, const std::string& deviceId) const
+{
+    auto it = byDeviceId_.find(ProductDeviceId(productId, deviceId));
+    if (it == byDeviceId_.end()) {
+        return nullptr;
+    }
+    return find(it->second);
+}
+
+int BookmarkTable::put(const DeviceInfo& device)
+{
+    int i;
+    auto existing = byDeviceId_.find(ProductDeviceId(device.productId_, device.deviceId_));
+    if (existing != byDeviceId_.end()) {
+        i = existing->second;
+    } else if (bookmarks_.empty()) {
+        i = 0;
+    } else {
+        // Deleted bookmarks leave gaps, the indexes of the remaining bookmarks are kept.
+        i = bookmarks_.rbegin()->first + 1;
+    }
+    put(i, device);
+    return i;
+}
+
+void BookmarkTable::put(int i, const DeviceInfo& device)
+{
+    auto it = bookmarks_.find(i);
+    if (it != bookmarks_.end()) {
+        unindex(it->second);
+    }
+    DeviceInfo& bookmark = bookmarks_[i];
+    bookmark = device;
+    index(i, bookmark);
+}
+
+bool BookmarkTable::erase(int i)
+{
+    auto it = bookmarks_.find(i);
+    if (it == bookmarks_.end()) {
+        return false;
+    }
+    unindex(it->second);
+    bookmarks_.erase(it);
+    return true;
+}
+
+void BookmarkTable::clear()
+{
+    bookmarks_.clear();
+    byFingerprint_.clear();
+    byDeviceId_.clear();
+}
+
+void BookmarkTable::index(int i, DeviceInfo& device)
+{
+    device.index_ = i;
+    byFingerprint_[device.deviceFingerprint_] = i;
+    byDeviceId_[ProductDeviceId(device.productId_, device.deviceId_)] = i;
+}
+
+void BookmarkTable::unindex(const DeviceInfo& device)
+{
+    auto fingerprint = byFingerprint_.find(device.deviceFingerprint_);
+    if (fingerprint != byFingerprint_.end() && fingerprint->second == device.index_) {
+        byFingerprint_.erase(fingerprint);
+    }
+    auto deviceId = byDeviceId_.find(ProductDeviceId(device.productId_, device.deviceId_));
+    if (deviceId != byDeviceId_.end() && deviceId->second == device.index_) {
+        byDeviceId_.erase(deviceId);
+    }
+}
+
+StateStore::StateStore(const std::string& stateFilePath)
+    : snapshotPath_(stateFilePath),
+      journalPath_(stateFilePath + ".journal"),
+      lockPath_(stateFilePath + ".lock"),
+      loaded_(false),
+      table_(std::make_shared<BookmarkTable>()),
+      changed_(true),
+      watching_(false)
+{
+}
+
+StateStore::~StateStore()
+{
+    stopWatcher();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void StateStore::setEncoding(FileEncoding encoding)
+{
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    encoding_ = encoding;
+}
+
+std::shared_ptr<const BookmarkTable> StateStore::bookmarks() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(tableMutex_);
+    return table_;
+}
+
+void StateStore::publish(std::shared_ptr<BookmarkTable> table)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(tableMutex_);
+    table_ = table;
+    publishedStamp_ = journalStamp_;
+}
+
+void StateStore::update(std::function<void (BookmarkTable& table)> change)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(tableMutex_);
+    // No snapshot can be taken while the lock is held, so if no one holds
+    // one the table can be changed in place.
+    if (table_.use_count() == 1) {
+        change(*table_);
+        publishedStamp_ = journalStamp_;
+        return;
+    }
+    lock.unlock();
+    // Only changes, which are serialized, replace the table.
+    auto table = std::make_shared<BookmarkTable>(*table_);
+    change(*table);
+    publish(table);
+}
+
+bool StateStore::load()
+{
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    if (loaded_) {
+        return true;
+    }
+    StateLock fileLock(lockPath_);
+    return loadLocked();
+}
+
+bool StateStore::loadLocked()
+{
+    auto table = std::make_shared<BookmarkTable>();
+    version_ = 0;
+    journalVersion_ = 0;
+    journalOffset_ = 0;
+    journalRecords_ = 0;
+    journalStamp_ = StatFile(journalPath_);
+
+    try
+    {
+        MappedFile StateFile(snapshotPath_);
+        if (!StateFile.empty()) {
+            snapshotEncoding_ = IsJson(StateFile.begin(), StateFile.end()) ? FileEncoding::JSON : FileEncoding::CBOR;
+            json StateContents = DecodeDocument(StateFile.begin(), StateFile.end());
+            for (const auto& Device : StateContents.at("devices"))
+            {
+                // Older state files do not have indexes, the bookmarks are numbered in order.
+                int Index = static_cast<int>(table->size());
+                auto IndexValue = Device.find("Index");
+                if (IndexValue != Device.end()) {
+                    Index = IndexValue->get<int>();
+                }
+                table->put(Index, Device.get<DeviceInfo>());
+            }
+            auto Version = StateContents.find("Version");
+            if (Version != StateContents.end()) {
+                version_ = Version->get<uint64_t>();
+            }
+        }
+        // NOTE(as): Otherwise the state file wasn't found, it'll probably be created later.
+    }
+    catch (...)
+    {
+        publish(std::make_shared<BookmarkTable>());
+        loaded_ = true;
+        return false;
+    }
+
+    // A journal without a version header belongs to the first snapshot.
+    journalVersion_ = journalStamp_.exists ? 0 : version_;
+    bool complete = readJournal(*table);
+    publish(table);
+    // Readers which see loaded_ use the published table without loading.
+    loaded_ = true;
+    if (!complete) {
+        dropIncompleteJournal();
+    }
+    return true;
+}
+
+void StateStore::dropIncompleteJournal()
+{
+    // A record which was only partially written when a client stopped,
+    // the records after it cannot be trusted. Compact such that new
+    // records are not appended to it, append refuses to until then.
+    std::cerr << "Ignoring the incomplete end of the state journal " << journalPath_ << std::endl;
+    if (!compactLocked()) {
+        setFailed();
+    }
+}
+
+bool StateStore::readJournal(BookmarkTable& table)
+{
+    MappedFile Journal(journalPath_);
+    const char* Line = Journal.begin() + journalOffset_;
+    while (Line < Journal.end()) {
+        const char* LineEnd = std::find(Line, Journal.end(), '\n');
+        if (LineEnd == Journal.end()) {
+            // Every complete record ends with a newline.
+            return false;
+        }
+        try {
+            if (LineEnd != Line) {
+                json Record = json::parse(Line, LineEnd);
+                auto Version = Record.find("Version");
+                if (Version != Record.end()) {
+                    journalVersion_ = Version->get<uint64_t>();
+                } else if (journalVersion_ >= version_) {
+                    // Records of an older journal are part of the snapshot.
+                    std::string Op = Record.at("Op").get<std::string>();
+                    int Index = Record.at("Index").get<int>();
+                    if (Op == "Put") {
+                        table.put(Index, Record.at("Device").get<DeviceInfo>());
+                    } else if (Op == "Delete") {
+                        table.erase(Index);
+                    }
+                    journalRecords_++;
+                }
+            }
+        } catch (std::exception& e) {
+            return false;
+        }
+        Line = LineEnd + 1;
+        journalOffset_ = Line - Journal.begin();
+    }
+    return true;
+}
+
+void StateStore::catchUpLocked()
+{
+    FileStamp Current = StatFile(journalPath_);
+    if (Current == journalStamp_) {
+        std::unique_lock<std::shared_timed_mutex> tableLock(tableMutex_);
+        publishedStamp_ = journalStamp_;
+        return;
+    }
+
+    // The journal is replaced when another process compacts it, the new
+    // journal has another version.
+    uint64_t Version = 0;
+    bool Replaced = !Current.exists || Current.size < journalOffset_;
+    if (!Replaced) {
+        std::ifstream Journal(journalPath_, std::ios::binary);
+        std::string Header;
+        std::getline(Journal, Header);
+        try {
+            json Record = json::parse(Header);
+            if (Record.contains("Version")) {
+                Version = Record["Version"].get<uint64_t>();
+            }
+        } catch (std::exception& e) {
+            Replaced = true;
+        }
+        Replaced = Replaced || Version != journalVersion_;
+    }
+
+    if (Replaced) {
+        loadLocked();
+        return;
+    }
+    journalStamp_ = Current;
+    // The journal is read into a copy, such that readers only wait for
+    // the table to be swapped and not for the file.
+    auto table = std::make_shared<BookmarkTable>(*bookmarks());
+    bool complete = readJournal(*table);
+    publish(table);
+    if (!complete) {
+        dropIncompleteJournal();
+    }
+}
+
+void StateStore::refresh()
+{
+    if (watching_ && !changed_.exchange(false)) {
+        return;
+    }
+    FileStamp Current = StatFile(journalPath_);
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(tableMutex_);
+        if (Current == publishedStamp_) {
+            return;
+        }
+    }
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    StateLock fileLock(lockPath_);
+    catchUpLocked();
+}
+
+int StateStore::put(const DeviceInfo& device)
+{
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    StateLock fileLock(lockPath_);
+    if (!fileLock.locked()) {
+        setLockFailed();
+        return -1;
+    }
+    catchUpLocked();
+    int Index;
+    update([&Index, &device](BookmarkTable& table) { Index = table.put(device); });
+    json Record = { {"Op", "Put"}, {"Index", Index}, {"Device", device} };
+    append(Record);
+    return Index;
+}
+
+bool StateStore::erase(int index)
+{
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    StateLock fileLock(lockPath_);
+    if (!fileLock.locked()) {
+        setLockFailed();
+        return false;
+    }
+    catchUpLocked();
+    if (!bookmarks()->find(index)) {
+        return false;
+    }
+    update([index](BookmarkTable& table) { table.erase(index); });
+    json Record = { {"Op", "Delete"}, {"Index", index} };
+    append(Record);
+    return true;
+}
+
+bool StateStore::append(const json& record)
+{
+    std::string Data;
+    if (!journalStamp_.exists) {
+        journalVersion_ = version_;
+        Data = json({ {"Version", version_} }).dump() + "\n";
+    }
+    Data += record.dump() + "\n";
+
+    if (journalStamp_.size != journalOffset_) {
+        // The journal ends with an incomplete record which could not be
+        // compacted away, the change is written by the next compaction.
+        setFailed();
+        return false;
+    }
+
+    // Synced to disk later by flush.
+    if (!AppendStringToFile(Data, journalPath_)) {
+        setFailed();
+        return false;
+    }
+    journalOffset_ += Data.size();
+    journalRecords_++;
+    journalStamp_ = StatFile(journalPath_);
+    {
+        std::unique_lock<std::shared_timed_mutex> tableLock(tableMutex_);
+        publishedStamp_ = journalStamp_;
+    }
+    dirty_ = true;
+    return true;
+}
+
+bool StateStore::compactLocked()
+{
+    uint64_t Version = version_ + 1;
+    json Contents = BookmarksToDocument(bookmarks()->all());
+    Contents["Version"] = Version;
+    if (!WriteStringToFile(EncodeDocument(Contents, encoding_), snapshotPath_)) {
+        return false;
+    }
+    version_ = Version;
+    snapshotEncoding_ = encoding_;
+
+    // If the client stops before the journal is replaced the records in
+    // the old journal are skipped since its version is older.
+    std::string Header = json({ {"Version", Version} }).dump() + "\n";
+    if (!WriteStringToFile(Header, journalPath_)) {
+        return false;
+    }
+    journalVersion_ = Version;
+    journalOffset_ = Header.size();
+    journalRecords_ = 0;
+    journalStamp_ = StatFile(journalPath_);
+    {
+        std::unique_lock<std::shared_timed_mutex> tableLock(tableMutex_);
+        publishedStamp_ = journalStamp_;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    forceCompaction_ = false;
+    return true;
+}
+
+void StateStore::setFailed()
+{
+    // The lost changes are recovered by writing a new snapshot.
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+    forceCompaction_ = true;
+}
+
+void StateStore::setLockFailed()
+{
+    // Nothing was written, so there is nothing to recover.
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+}
+
+bool StateStore::flush()
+{
+    std::lock_guard<std::mutex> updateLock(updateMutex_);
+    bool Compact;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Compact = forceCompaction_;
+    }
+    if (Compact || snapshotEncoding_ != encoding_ || journalRecords_ > std::max(minCompactRecords, bookmarks()->size())) {
+        StateLock fileLock(lockPath_);
+        if (!fileLock.locked()) {
+            setLockFailed();
+        } else {
+            catchUpLocked();
+            if (compactLocked()) {
+                // The snapshot and the journal were synced when written.
+                dirty_ = false;
+            } else {
+                setFailed();
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dirty_) {
+        dirty_ = false;
+        scheduled_ = true;
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&StateStore::run, this);
+        }
+        cond_.notify_all();
+    }
+    return !failed_;
+}
+
+bool StateStore::sync()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    urgent_ = true;
+    cond_.notify_all();
+    cond_.wait(lock, [this]() { return !scheduled_ && !syncing_; });
+    urgent_ = false;
+    bool ok = !failed_;
+    failed_ = false;
+    return ok;
+}
+
+void StateStore::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cond_.wait(lock, [this]() { return scheduled_ || stopped_; });
+        if (!scheduled_) {
+            return;
+        }
+        // Let a burst of changes end before syncing.
+        cond_.wait_for(lock, coalesceDelay, [this]() { return urgent_ || stopped_; });
+        scheduled_ = false;
+        syncing_ = true;
+        lock.unlock();
+
+        bool ok = SyncFileToDisk(journalPath_);
+
+        lock.lock();
+        if (!ok) {
+            failed_ = true;
+            forceCompaction_ = true;
+        }
+        syncing_ = false;
+        cond_.notify_all();
+    }
+}
+
+void StateStore::watch(std::function<void ()> onChange)
+{
+    {
+        std::lock_guard<std::mutex> lock(watchMutex_);
+        onChange_ = onChange;
+    }
+    std::lock_guard<std::mutex> lock(updateMutex_);
+    if (!onChange || watching_) {
+        return;
+    }
+#if defined(__linux__)
+    std::string Directory = snapshotPath_.substr(0, snapshotPath_.rfind('/') + 1);
+    watchFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd_ < 0 || inotify_add_watch(watchFd_, Directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO) < 0 || pipe2(stopFds_, O_CLOEXEC) != 0) {
+        std::cerr << "Could not watch the state directory " << Directory << std::endl;
+        stopWatcher();
+        return;
+    }
+    std::string JournalName = journalPath_.substr(journalPath_.rfind('/') + 1);
+    watching_ = true;
+    changed_ = true;
+    watcher_ = std::thread([this, JournalName]() {
+        struct pollfd fds[2] = { { watchFd_, POLLIN, 0 }, { stopFds_[0], POLLIN, 0 } };
+        alignas(struct inotify_event) char buffer[4096];
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (fds[1].revents != 0) {
+                return;
+            }
+            bool changed = false;
+            ssize_t length;
+            while ((length = read(watchFd_, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + length; ) {
+                    struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+                    // Every change of the state ends up in the journal.
+                    if (event->len > 0 && JournalName == event->name) {
+                        changed = true;
+                    }
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            if (changed) {
+                changed_ = true;
+                std::lock_guard<std::mutex> lock(watchMutex_);
+                if (onChange_) {
+                    onChange_();
+                }
+            }
+        }
+    });
+#endif
+}
+
+void StateStore::stopWatcher()
+{
+#if defined(__linux__)
+    if (watcher_.joinable()) {
+        char stop = 0;
+        if (write(stopFds_[1], &stop, 1) != 1) {
+            std::cerr << "Could not stop the state watcher" << std::endl;
+        }
+        watcher_.join();
+    }
+    for (int fd : { watchFd_, stopFds_[0], stopFds_[1] }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    watchFd_ = -1;
+    stopFds_[0] = -1;
+    stopFds_[1] = -1;
+#endif
+    watching_ = false;
+}
+
+} // namespace
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Configuration
+{
+
+/**
+ * Decode a JSON or CBOR document, the encoding is detected from the
+ * first byte. Throws nlohmann::json::exception on malformed input.
+ */
+nlohmann::json DecodeDocument(const char* begin, const char* end);
+std::string EncodeDocument(const nlohmann::json& document, FileEncoding encoding);
+
+// The state file document, {"devices": [...]}.
+nlohmann::json BookmarksToDocument(const std::map<int, DeviceInfo>& bookmarks);
+
+/**
+ * The bookmarks with indexes on the fingerprint and on the product and
+ * device id.
+ */
+class BookmarkTable {
+ public:
+    const DeviceInfo* find(int index) const;
+    const DeviceInfo* findByFingerprint(const std::string& fingerprint) const;
+    const DeviceInfo* findByDeviceId(const std::string& productId, const std::string& deviceId) const;
+
+    /**
+     * Insert the device, or replace the bookmark with the same product
+     * and device id. Returns the index of the bookmark.
+     */
+    int put(const DeviceInfo& device);
+    void put(int index, const DeviceInfo& device);
+    bool erase(int index);
+    void clear();
+
+    const std::map<int, DeviceInfo>& all() const { return bookmarks_; }
+    bool empty() const { return bookmarks_.empty(); }
+    size_t size() const { return bookmarks_.size(); }
+
+ private:
+    typedef std::pair<std::string, std::string> ProductDeviceId;
+
+    struct ProductDeviceIdHash {
+        size_t operator()(const ProductDeviceId& id) const {
+            return std::hash<std::string>()(id.first) ^ (std::hash<std::string>()(id.second) << 1);
+        }
+    };
+
+    void index(int index, DeviceInfo& device);
+    void unindex(const DeviceInfo& device);
+
+    std::map<int, DeviceInfo> bookmarks_;
+    std::unordered_map<std::string, int> byFingerprint_;
+    std::unordered_map<ProductDeviceId, int, ProductDeviceIdHash> byDeviceId_;
+};
+
+/**
+ * Persistent storage of the bookmarks, shared by the client processes
+ * using the same home directory.
+ *
+ * The state file holds a versioned snapshot of all the bookmarks.
+ * Changes are appended to a journal next to it, one JSON record per
+ * line, such that adding or deleting a bookmark does not rewrite the
+ * state file. The journal starts with the version of the snapshot it
+ * belongs to. When it has grown larger than the number of bookmarks it
+ * is compacted into a new snapshot.
+ *
+ * Changes are made under an advisory lock on a lock file next to the
+ * state file. The journal records written by other processes are
+ * applied before a change, so concurrent pairings are merged instead of
+ * overwriting each other. Syncing the journal to disk is done by a
+ * background thread, changes flushed within a short delay of each
+ * other are synced together. The destructor waits for the scheduled
+ * syncs.
+ *
+ * The store can be used from several threads. Changes are serialized,
+ * readers get an immutable snapshot of the bookmarks. A change replaces
+ * a table which is held as a snapshot with a modified copy, so reading
+ * never waits for file I/O.
+ */
+class StateStore {
+ public:
+    StateStore(const std::string& stateFilePath);
+    ~StateStore();
+
+    /**
+     * Encoding of the snapshots written from now on. A snapshot in
+     * another encoding is rewritten on the next flush.
+     */
+    void setEncoding(FileEncoding encoding);
+
+    /**
+     * Load the snapshot and replay the journal, unless that has been
+     * done. Returns false if the state file is corrupt, there are no
+     * bookmarks in that case.
+     */
+    bool load();
+    bool isLoaded() const { return loaded_; }
+
+    /**
+     * Pick up the changes written by other processes. Only the new
+     * journal records are read, unless the journal has been compacted.
+     */
+    void refresh();
+
+    /**
+     * Call onChange when the state files are changed, on Linux this is
+     * detected with inotify. The callback is invoked from a watcher
+     * thread, the changes are read by the next refresh. An empty
+     * callback stops the notifications.
+     */
+    void watch(std::function<void ()> onChange);
+
+    /**
+     * The current bookmarks. The snapshot is not changed by later
+     * changes, call this again to see them.
+     */
+    std::shared_ptr<const BookmarkTable> bookmarks() const;
+
+    /**
+     * Add or replace a bookmark, see BookmarkTable::put. The change is
+     * written to the journal before this returns. Returns -1 and erase
+     * returns false if the state files could not be locked, flush then
+     * reports the failure.
+     */
+    int put(const DeviceInfo& device);
+    bool erase(int index);
+
+    /**
+     * Compact the journal if it has become too large, and schedule it
+     * to be synced to disk. Returns false if an earlier write has failed.
+     */
+    bool flush();
+
+    /**
+     * Wait until the scheduled syncs are done. Returns false if any
+     * write failed since the last sync.
+     */
+    bool sync();
+
+ private:
+    StateStore(const StateStore&) = delete;
+    StateStore& operator=(const StateStore&) = delete;
+
+    bool loadLocked();
+    void catchUpLocked();
+    bool readJournal(BookmarkTable& table);
+    void dropIncompleteJournal();
+    void publish(std::shared_ptr<BookmarkTable> table);
+    void update(std::function<void (BookmarkTable& table)> change);
+    bool append(const nlohmann::json& record);
+    bool compactLocked();
+    void setFailed();
+    void setLockFailed();
+    void run();
+    void stopWatcher();
+
+    static const std::chrono::milliseconds coalesceDelay;
+
+    std::string snapshotPath_;
+    std::string journalPath_;
+    std::string lockPath_;
+
+    // Guards the state below, held while the state files are read or written.
+    std::mutex updateMutex_;
+    std::atomic<bool> loaded_;
+    uint64_t version_ = 0;
+    uint64_t journalVersion_ = 0;
+    uint64_t journalOffset_ = 0;
+    FileStamp journalStamp_;
+    size_t journalRecords_ = 0;
+    bool dirty_ = false;
+    FileEncoding encoding_ = FileEncoding::JSON;
+    FileEncoding snapshotEncoding_ = FileEncoding::JSON;
+
+    mutable std::shared_timed_mutex tableMutex_;
+    std::shared_ptr<BookmarkTable> table_;
+    FileStamp publishedStamp_;
+
+    // Guards the state of the sync thread.
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    bool scheduled_ = false;
+    bool syncing_ = false;
+    bool urgent_ = false;
+    bool stopped_ = false;
+    bool failed_ = false;
+    bool forceCompaction_ = false;
+
+    std::mutex watchMutex_;
+    std::function<void ()> onChange_;
+    std::thread watcher_;
+    std::atomic<bool> changed_;
+    std::atomic<bool> watching_;
+    int watchFd_ = -1;
+    int stopFds_[2] = { -1, -1 };
+};
+
+} // namespace
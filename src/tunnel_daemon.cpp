@@ -0,0 +1,150 @@
+#include "tunnel_daemon.hpp"
+
+#include <3rdparty/nlohmann/json.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using json = nlohmann::json;
+
+static const std::chrono::milliseconds closeTimeout = std::chrono::milliseconds(5000);
+
+TunnelDaemon::TunnelDaemon(std::shared_ptr<nabto::client::Context> context, std::shared_ptr<MetricsRegistry> metrics)
+    : context_(context), metrics_(metrics)
+{
+}
+
+bool TunnelDaemon::loadManifest(const std::string& path)
+{
+    json manifest;
+    try {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Cannot open the tunnel manifest " << path << std::endl;
+            return false;
+        }
+        file >> manifest;
+    } catch (std::exception& e) {
+        std::cerr << "The tunnel manifest " << path << " is not valid JSON: " << e.what() << std::endl;
+        return false;
+    }
+
+    devices_.clear();
+    try {
+        for (auto& entry : manifest.at("Tunnels")) {
+            std::unique_ptr<Configuration::DeviceInfo> device;
+            if (entry.contains("Bookmark")) {
+                device = Configuration::GetPairedDevice(entry["Bookmark"].get<int>());
+            } else if (entry.contains("DeviceFingerprint")) {
+                device = Configuration::GetPairedDevice(entry["DeviceFingerprint"].get<std::string>());
+            } else {
+                std::cerr << "The tunnel manifest entry " << entry.dump() << " has neither a Bookmark nor a DeviceFingerprint" << std::endl;
+                return false;
+            }
+            if (!device) {
+                std::cerr << "The device for the tunnel manifest entry " << entry.dump() << " is not a bookmarked device" << std::endl;
+                return false;
+            }
+
+            TunnelSpec spec;
+            spec.service = entry.at("Service").get<std::string>();
+            if (entry.contains("LocalPort")) {
+                spec.localPort = entry["LocalPort"].get<uint16_t>();
+            }
+
+            // Tunnels to the same device share a connection.
+            bool found = false;
+            for (auto& d : devices_) {
+                if (d.device.getDeviceFingerprint() == device->getDeviceFingerprint()) {
+                    d.tunnels.push_back(spec);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                DeviceTunnels d;
+                d.device = *device;
+                d.tunnels.push_back(spec);
+                devices_.push_back(d);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "The tunnel manifest " << path << " is not valid: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (devices_.empty()) {
+        std::cerr << "The tunnel manifest " << path << " does not contain any tunnels" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TunnelDaemon::run()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return true;
+        }
+        for (auto& d : devices_) {
+            supervisors_.push_back(std::make_shared<TunnelSupervisor>(context_, d.device, d.tunnels, metrics_));
+        }
+    }
+
+    // The first connects are dialed together through future callbacks,
+    // so starting a large manifest takes as long as the slowest device.
+    std::vector<Configuration::DeviceInfo> devices;
+    for (auto& d : devices_) {
+        devices.push_back(d.device);
+    }
+    auto dials = createConnections(context_, devices);
+
+    bool stopped;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped = stopped_;
+    }
+    if (stopped) {
+        for (auto& dial : dials) {
+            if (dial.connection) {
+                closeConnection(dial.connection, closeTimeout);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        supervisors_.clear();
+        return true;
+    }
+
+    // Once connected a supervisor sleeps until its connection is closed
+    // or a backoff ends, only reconnects are dialed from its thread.
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < supervisors_.size(); i++) {
+        auto supervisor = supervisors_[i];
+        auto dial = dials[i];
+        threads.push_back(std::thread([supervisor, dial, &ok]() {
+            if (!supervisor->run(dial)) {
+                ok = false;
+            }
+        }));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    supervisors_.clear();
+    return ok;
+}
+
+void TunnelDaemon::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    for (auto& supervisor : supervisors_) {
+        supervisor->stop();
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "tunnel_supervisor.hpp"
+
+#include <nabto_client.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Keeps tunnels to many devices open from a single process.
+ *
+ * The tunnels are read from a JSON manifest. Each entry names a device
+ * by its bookmark index or its fingerprint and the service to tunnel:
+ *
+ *   {
+ *     "Tunnels": [
+ *       { "Bookmark": 0, "Service": "ssh", "LocalPort": 2222 },
+ *       { "DeviceFingerprint": "a1b2...", "Service": "http" }
+ *     ]
+ *   }
+ *
+ * All devices share one nabto client context, every device gets a
+ * TunnelSupervisor which reconnects it independently of the others.
+ */
+class TunnelDaemon {
+ public:
+    // The connections to the devices are recorded in metrics if it is given.
+    TunnelDaemon(std::shared_ptr<nabto::client::Context> context, std::shared_ptr<MetricsRegistry> metrics = nullptr);
+
+    /**
+     * Read the manifest and resolve the devices against the bookmarks.
+     * Returns false and prints the reason if the manifest is invalid.
+     */
+    bool loadManifest(const std::string& path);
+
+    /**
+     * Run the supervisors until stop() is called. Returns false if any
+     * of the supervisors gave up.
+     */
+    bool run();
+
+    /**
+     * Stop all supervisors, can be called from any thread.
+     */
+    void stop();
+
+ private:
+    class DeviceTunnels {
+     public:
+        Configuration::DeviceInfo device;
+        std::vector<TunnelSpec> tunnels;
+    };
+
+    std::shared_ptr<nabto::client::Context> context_;
+    std::shared_ptr<MetricsRegistry> metrics_;
+    std::vector<DeviceTunnels> devices_;
+
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<TunnelSupervisor> > supervisors_;
+    bool stopped_ = false;
+};
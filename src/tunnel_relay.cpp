@@ -0,0 +1,150 @@
+#include "tunnel_relay.hpp"
+
+#include <vector>
+
+// How often blocked threads check whether the relay has been stopped.
+static const std::chrono::milliseconds pollInterval = std::chrono::milliseconds(250);
+static const size_t bufferSize = 16384;
+
+TunnelRelay::TunnelRelay(std::shared_ptr<TunnelCounters> counters)
+    : counters_(counters)
+{
+}
+
+TunnelRelay::~TunnelRelay()
+{
+    stop();
+}
+
+bool TunnelRelay::listen(uint16_t port)
+{
+    listener_ = LocalSocket::listen(port);
+    if (listener_ == LocalSocket::invalid) {
+        return false;
+    }
+    localPort_ = LocalSocket::localPort(listener_);
+    acceptThread_ = std::thread([this]() { acceptLoop(); });
+    return true;
+}
+
+uint16_t TunnelRelay::getLocalPort()
+{
+    return localPort_;
+}
+
+void TunnelRelay::setTarget(uint16_t port)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    target_ = port;
+}
+
+void TunnelRelay::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    if (acceptThread_.joinable()) {
+        acceptThread_.join();
+    }
+    if (listener_ != LocalSocket::invalid) {
+        LocalSocket::close(listener_);
+        listener_ = LocalSocket::invalid;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return sessions_ == 0; });
+}
+
+bool TunnelRelay::isStopped()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopped_;
+}
+
+void TunnelRelay::acceptLoop()
+{
+    while (!isStopped()) {
+        bool readable = false;
+        if (!LocalSocket::waitReadable(&listener_, &readable, 1, pollInterval)) {
+            continue;
+        }
+        socket_type client = LocalSocket::accept(listener_);
+        if (client == LocalSocket::invalid) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sessions_++;
+        }
+        // The session threads are waited for by counting them in stop.
+        std::thread([this, client]() {
+            forward(client);
+            std::lock_guard<std::mutex> lock(mutex_);
+            sessions_--;
+            cond_.notify_all();
+        }).detach();
+    }
+}
+
+void TunnelRelay::forward(socket_type client)
+{
+    auto started = std::chrono::steady_clock::now();
+    counters_->sessionOpened();
+
+    uint16_t target;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        target = target_;
+    }
+    socket_type device = target == 0 ? LocalSocket::invalid : LocalSocket::connect(target);
+    bool error = device == LocalSocket::invalid;
+
+    if (!error) {
+        // Index 0 is the local client and 1 the nabto tunnel. A side is
+        // open until it has ended its stream, the end is passed on.
+        socket_type sockets[2] = { client, device };
+        bool open[2] = { true, true };
+        std::vector<uint8_t> buffer(bufferSize);
+        while ((open[0] || open[1]) && !isStopped()) {
+            socket_type waiting[2];
+            size_t sides[2];
+            size_t count = 0;
+            for (size_t i = 0; i < 2; i++) {
+                if (open[i]) {
+                    waiting[count] = sockets[i];
+                    sides[count++] = i;
+                }
+            }
+            bool readable[2] = { false, false };
+            if (!LocalSocket::waitReadable(waiting, readable, count, pollInterval)) {
+                continue;
+            }
+            for (size_t k = 0; k < count && !error; k++) {
+                if (!readable[k]) {
+                    continue;
+                }
+                size_t from = sides[k];
+                socket_type to = sockets[1 - from];
+                int64_t n = LocalSocket::receive(sockets[from], buffer.data(), buffer.size());
+                if (n < 0) {
+                    error = true;
+                } else if (n == 0) {
+                    open[from] = false;
+                    LocalSocket::shutdownWrite(to);
+                } else if (!LocalSocket::sendAll(to, buffer.data(), (size_t)n)) {
+                    error = true;
+                } else if (from == 0) {
+                    counters_->addBytesUp(n);
+                } else {
+                    counters_->addBytesDown(n);
+                }
+            }
+            if (error) {
+                break;
+            }
+        }
+        LocalSocket::close(device);
+    }
+    LocalSocket::close(client);
+    counters_->sessionClosed(std::chrono::steady_clock::now() - started, error);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "connection_metrics.hpp"
+#include "local_socket.hpp"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Listens on the local port of a tunnel and forwards every TCP session
+ * to the local port of the nabto tunnel, counting the bytes and the
+ * sessions.
+ *
+ * The nabto tunnel is opened on a free port and the relay keeps the
+ * port the local clients use, so the port stays the same when the
+ * device is reconnected. Each session is forwarded by its own thread.
+ */
+class TunnelRelay {
+ public:
+    TunnelRelay(std::shared_ptr<TunnelCounters> counters);
+    ~TunnelRelay();
+
+    /**
+     * Start listening, port 0 picks a free port. Returns false if the
+     * port cannot be used.
+     */
+    bool listen(uint16_t port);
+    uint16_t getLocalPort();
+
+    /**
+     * The port of the nabto tunnel the sessions are forwarded to, 0
+     * while there is no tunnel. Sessions accepted without a tunnel are
+     * closed at once and counted as errors.
+     */
+    void setTarget(uint16_t port);
+
+    /**
+     * Stop listening and close the sessions, waits for the session
+     * threads to end.
+     */
+    void stop();
+
+ private:
+    TunnelRelay(const TunnelRelay&) = delete;
+    TunnelRelay& operator=(const TunnelRelay&) = delete;
+
+    void acceptLoop();
+    void forward(socket_type client);
+    bool isStopped();
+
+    std::shared_ptr<TunnelCounters> counters_;
+    socket_type listener_ = LocalSocket::invalid;
+    uint16_t localPort_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    uint16_t target_ = 0;
+    size_t sessions_ = 0;
+    bool stopped_ = false;
+    std::thread acceptThread_;
+};
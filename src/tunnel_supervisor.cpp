@@ -0,0 +1,225 @@
+#include "tunnel_supervisor.hpp"
+
+#include <nabto/nabto_client_experimental.h>
+
+#include <algorithm>
+#include <iostream>
+
+static const std::chrono::milliseconds minBackoff = std::chrono::milliseconds(1000);
+static const std::chrono::milliseconds maxBackoff = std::chrono::milliseconds(60000);
+// A device which does not answer within these limits is treated as gone.
+static const std::chrono::milliseconds openTimeout = std::chrono::milliseconds(15000);
+static const std::chrono::milliseconds closeTimeout = std::chrono::milliseconds(5000);
+
+class TunnelSupervisor::CloseListener : public nabto::client::ConnectionEventsCallback {
+ public:
+    CloseListener(TunnelSupervisor* supervisor)
+        : supervisor_(supervisor)
+    {
+    }
+
+    void onEvent(int event) {
+        if (event == NABTO_CLIENT_CONNECTION_EVENT_CLOSED) {
+            supervisor_->connectionClosed();
+        }
+    }
+ private:
+    TunnelSupervisor* supervisor_;
+};
+
+TunnelSupervisor::TunnelSupervisor(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device, std::vector<TunnelSpec> tunnels, std::shared_ptr<MetricsRegistry> metrics)
+    : context_(context), device_(device), tunnels_(tunnels), random_(std::random_device()())
+{
+    if (metrics) {
+        metrics_ = metrics->track(device);
+        for (auto& spec : tunnels) {
+            relays_.push_back(std::make_shared<TunnelRelay>(metrics->trackTunnel(device, spec.service)));
+        }
+    }
+}
+
+TunnelSupervisor::~TunnelSupervisor()
+{
+    for (auto& relay : relays_) {
+        relay->stop();
+    }
+}
+
+bool TunnelSupervisor::run()
+{
+    return runFrom(nullptr);
+}
+
+bool TunnelSupervisor::run(const DialResult& first)
+{
+    return runFrom(std::unique_ptr<DialResult>(new DialResult(first)));
+}
+
+bool TunnelSupervisor::runFrom(std::unique_ptr<DialResult> first)
+{
+    size_t attempt = 0;
+    bool opened = false;
+    while (!isStopped()) {
+        DialResult result;
+        if (first) {
+            result = *first;
+            first.reset();
+        } else {
+            result = createConnections(context_, { device_ })[0];
+        }
+        if (!result.ready) {
+            reportDialResult(result);
+            if (!result.retryable) {
+                return false;
+            }
+            if (!sleepBackoff(attempt++)) {
+                break;
+            }
+            continue;
+        }
+        auto connection = result.connection;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = false;
+        }
+        auto closeListener = std::make_shared<CloseListener>(this);
+        connection->addEventsListener(closeListener);
+        if (metrics_) {
+            metrics_->connected(connection, result.timeToReady);
+        }
+
+        std::vector<std::shared_ptr<nabto::client::TcpTunnel> > tunnels;
+        bool retryable = opened;
+        if (openTunnels(connection, tunnels, retryable)) {
+            opened = true;
+            attempt = 0;
+            std::cout << "Connected to " << device_.getFriendlyName() << " in " << result.timeToReady.count() << "ms" << std::endl;
+            waitForCloseOrStop();
+        }
+
+        connection->removeEventsListener(closeListener);
+        if (metrics_) {
+            metrics_->disconnected();
+        }
+        tunnels.clear();
+        setRelayTargets(tunnels);
+        closeConnection(connection, closeTimeout);
+
+        if (!opened && !retryable) {
+            return false;
+        }
+        if (isStopped()) {
+            break;
+        }
+        std::cout << "Connection to " << device_.getFriendlyName() << " closed, reconnecting" << std::endl;
+        if (!sleepBackoff(attempt++)) {
+            break;
+        }
+    }
+    // The supervisor can be stopped before it used the first dial.
+    if (first && first->connection) {
+        closeConnection(first->connection, closeTimeout);
+    }
+    return true;
+}
+
+bool TunnelSupervisor::openTunnels(std::shared_ptr<nabto::client::Connection> connection, std::vector<std::shared_ptr<nabto::client::TcpTunnel> >& tunnels, bool& retryable)
+{
+    std::vector<TunnelSpec> specs = getTunnels();
+    for (size_t i = 0; i < specs.size(); i++) {
+        auto& spec = specs[i];
+        // The relay keeps the local port and the tunnel gets a free one.
+        uint16_t tunnelPort = spec.localPort;
+        if (!relays_.empty()) {
+            auto& relay = relays_[i];
+            if (relay->getLocalPort() == 0 && !relay->listen(spec.localPort)) {
+                std::cerr << "Cannot listen on the local port " << spec.localPort << " for the service " << spec.service << std::endl;
+                return false;
+            }
+            tunnelPort = 0;
+        }
+
+        std::shared_ptr<nabto::client::TcpTunnel> tunnel;
+        try {
+            tunnel = connection->createTcpTunnel();
+            auto future = tunnel->open(spec.service, tunnelPort);
+            if (!future->waitFor(openTimeout)) {
+                tunnel->stop();
+            }
+            future->waitForResult();
+        } catch (nabto::client::NabtoException& e) {
+            std::cerr << "Failed to open a tunnel to " << spec.service << ":" << spec.localPort << " error: " << e.what() << std::endl;
+            // A closed connection is worth retrying, anything else is likely a misconfiguration.
+            retryable = retryable || e.status().getErrorCode() == nabto::client::Status::NOT_CONNECTED || e.status().getErrorCode() == nabto::client::Status::STOPPED;
+            return false;
+        }
+
+        if (!relays_.empty()) {
+            spec.localPort = relays_[i]->getLocalPort();
+        } else if (spec.localPort == 0) {
+            spec.localPort = tunnel->getLocalPort();
+        }
+        std::cout << "TCP Tunnel opened for the service " << spec.service << " listening on the local port " << spec.localPort << std::endl;
+        tunnels.push_back(tunnel);
+    }
+
+    setRelayTargets(tunnels);
+    std::lock_guard<std::mutex> lock(mutex_);
+    tunnels_ = specs;
+    return true;
+}
+
+void TunnelSupervisor::setRelayTargets(const std::vector<std::shared_ptr<nabto::client::TcpTunnel> >& tunnels)
+{
+    for (size_t i = 0; i < relays_.size(); i++) {
+        relays_[i]->setTarget(i < tunnels.size() ? tunnels[i]->getLocalPort() : 0);
+    }
+}
+
+void TunnelSupervisor::waitForCloseOrStop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this](){ return closed_ || stopped_; });
+}
+
+bool TunnelSupervisor::sleepBackoff(size_t attempt)
+{
+    // Equal jitter, sleep between half and the full exponential delay.
+    auto delay = maxBackoff;
+    if (attempt < 16) {
+        delay = std::min(maxBackoff, minBackoff * (1 << attempt));
+    }
+    std::uniform_int_distribution<int64_t> distribution(delay.count() / 2, delay.count());
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto jittered = std::chrono::milliseconds(distribution(random_));
+    std::cout << "Retrying " << device_.getFriendlyName() << " in " << jittered.count() << "ms" << std::endl;
+    return !cond_.wait_for(lock, jittered, [this](){ return stopped_; });
+}
+
+void TunnelSupervisor::connectionClosed()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cond_.notify_all();
+}
+
+void TunnelSupervisor::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    cond_.notify_all();
+}
+
+bool TunnelSupervisor::isStopped()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopped_;
+}
+
+std::vector<TunnelSpec> TunnelSupervisor::getTunnels()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tunnels_;
+}
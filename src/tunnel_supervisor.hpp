@@ -0,0 +1,86 @@
+#pragma once
+
+#include "config.hpp"
+#include "connect.hpp"
+#include "connection_metrics.hpp"
+#include "tunnel_relay.hpp"
+
+#include <nabto_client.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+class TunnelSpec {
+ public:
+    std::string service;
+    // 0 lets the client pick a port, the chosen port is reused on reconnects.
+    uint16_t localPort = 0;
+};
+
+/**
+ * Keeps a connection and its tcp tunnels open to a single device.
+ *
+ * When the connection is closed the supervisor reconnects with a
+ * jittered exponential backoff and reopens every tunnel on the same
+ * local port. Local clients will see connections being refused while
+ * the device is unreachable instead of the listener disappearing.
+ *
+ * With a metrics registry the connection is recorded in it, and the
+ * sessions of every tunnel go through a TunnelRelay which counts them.
+ */
+class TunnelSupervisor {
+ public:
+    TunnelSupervisor(std::shared_ptr<nabto::client::Context> context, Configuration::DeviceInfo device, std::vector<TunnelSpec> tunnels, std::shared_ptr<MetricsRegistry> metrics = nullptr);
+    ~TunnelSupervisor();
+
+    /**
+     * Run until stop() is called. Returns false if the supervisor gave
+     * up, e.g. the client is not paired with the device or a tunnel could
+     * not be opened the first time.
+     */
+    bool run();
+
+    /**
+     * Run starting from a connection which has already been dialed, such
+     * that the first connects of many devices can be dialed together.
+     */
+    bool run(const DialResult& first);
+
+    /**
+     * Stop the supervisor, can be called from any thread.
+     */
+    void stop();
+
+    std::vector<TunnelSpec> getTunnels();
+
+ private:
+    class CloseListener;
+
+    bool runFrom(std::unique_ptr<DialResult> first);
+
+    bool openTunnels(std::shared_ptr<nabto::client::Connection> connection, std::vector<std::shared_ptr<nabto::client::TcpTunnel> >& tunnels, bool& retryable);
+    void setRelayTargets(const std::vector<std::shared_ptr<nabto::client::TcpTunnel> >& tunnels);
+    void waitForCloseOrStop();
+    bool sleepBackoff(size_t attempt);
+    void connectionClosed();
+    bool isStopped();
+
+    std::shared_ptr<nabto::client::Context> context_;
+    Configuration::DeviceInfo device_;
+    std::shared_ptr<ConnectionMetrics> metrics_;
+    // One relay per tunnel spec, empty without metrics.
+    std::vector<std::shared_ptr<TunnelRelay> > relays_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<TunnelSpec> tunnels_;
+    bool stopped_ = false;
+    bool closed_ = false;
+
+    std::mt19937 random_;
+};